@@ -34,6 +34,10 @@ enum ins_opcode_t
 	READ,  // Write data to a byte on memory
 	WRITE, // Read data from a byte on memory
 	SYSCALL,
+	READW,  // Read a 32-bit word from memory
+	WRITEW, // Write a 32-bit word to memory
+	MEMSET, // Fill a range of memory with a byte
+	MEMCPY, // Copy a range of memory
 };
 
 /* instructions executed by the CPU */
@@ -44,12 +48,14 @@ struct inst_t
 	uint32_t arg_1;
 	uint32_t arg_2;
 	uint32_t arg_3;
+	uint32_t arg_4;
 };
 
 struct code_seg_t
 {
 	struct inst_t *text;
 	uint32_t size;
+	int refs; // Processes running it, forks share it
 };
 
 struct trans_table_t
@@ -98,6 +104,7 @@ struct pcb_t
 	struct memphy_struct **mswp;
 	struct memphy_struct *active_mswp;
 	uint32_t active_mswp_id;
+	int oom_killed;		 // Memory taken back by the OOM killer
 #endif
 	struct page_table_t *page_table; // Page table
 	uint32_t bp;			 // Break pointer
@@ -19,7 +19,13 @@
 extern struct vm_area_struct *get_vma_by_num(struct mm_struct *mm, int vmaid);
 int inc_vma_limit(struct pcb_t*, int, int);
 int __mm_swap_page(struct pcb_t*, int, int);
-int liballoc(struct pcb_t *, uint32_t, uint32_t);
+int liballoc(struct pcb_t *, uint32_t, uint32_t, uint32_t);
 int libfree(struct pcb_t *, uint32_t);
 int libread(struct pcb_t*, uint32_t, uint32_t, uint32_t*);
 int libwrite(struct pcb_t*, BYTE, uint32_t, uint32_t);
+int libread_range(struct pcb_t*, uint32_t, uint32_t, BYTE*, uint32_t);
+int libwrite_range(struct pcb_t*, const BYTE*, uint32_t, uint32_t, uint32_t);
+int libread_word(struct pcb_t*, uint32_t, uint32_t, uint32_t*);
+int libwrite_word(struct pcb_t*, uint32_t, uint32_t, uint32_t);
+int libmemset(struct pcb_t*, BYTE, uint32_t, uint32_t, uint32_t);
+int libmemcpy(struct pcb_t*, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t);
@@ -5,5 +5,9 @@
 
 struct pcb_t * load(const char * path);
 
+struct pcb_t * clone_pcb(struct pcb_t * parent);
+
+void unload(struct pcb_t * proc);
+
 #endif
 
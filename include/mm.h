@@ -3,6 +3,7 @@
 
 #include "bitops.h"       // Required for BIT(), GENMASK(), NBITS(), etc.
 #include "common.h"
+#include <pthread.h>
 
 /*===========================================================================
  * CPU Bus and Paging Definitions
@@ -18,19 +19,35 @@
 
 #define PAGING_SBRK_INIT_SZ  PAGING_PAGESZ
 
+/* Every process has a heap growing up from 0 and a stack growing down from
+ * the top of the address space. mmap areas are placed top-down below the
+ * room kept for the stack, and take the following ids. */
+#define VMA_HEAP_ID          0
+#define VMA_STACK_ID         1
+#define PAGING_STACK_MAX     (BIT(PAGING_CPU_BUS_WIDTH) / 8)
+
+/* Host files an mmap area can map, "mmapfile<N>" in config, N from 1 */
+#define PAGING_MAX_MMFILE    8
+/* Shared memory segments in the system */
+#define PAGING_MAX_SHM       16
+
 /*===========================================================================
  * PTE Bit Definitions and Macros
  *===========================================================================*/
 #define PAGING_PTE_PRESENT_MASK   BIT(31)
 #define PAGING_PTE_SWAPPED_MASK   BIT(30)
-#define PAGING_PTE_RESERVE_MASK   BIT(29)
+#define PAGING_PTE_RESERVE_MASK   BIT(29)  /* reserved, frame given on first touch */
 #define PAGING_PTE_DIRTY_MASK     BIT(28)
-#define PAGING_PTE_EMPTY01_MASK   BIT(14)
-#define PAGING_PTE_EMPTY02_MASK   BIT(13)
+#define PAGING_PTE_COW_MASK       BIT(27)  /* frame or slot shared by fork, copied on write */
+#define PAGING_PTE_ACCESSED_MASK  BIT(14)  /* set on access, valid while online */
+#define PAGING_PTE_RAHEAD_MASK    BIT(13)  /* read ahead, not accessed yet, valid while online */
 
 /* PTE utility macros */
 #define PAGING_PTE_SET_PRESENT(pte)  ((pte) |= PAGING_PTE_PRESENT_MASK)
 #define PAGING_PAGE_PRESENT(pte)     ((pte) & PAGING_PTE_PRESENT_MASK)
+#define PAGING_PAGE_SWAPPED(pte)     ((pte) & PAGING_PTE_SWAPPED_MASK)
+#define PAGING_PAGE_ONLINE(pte)      (PAGING_PAGE_PRESENT(pte) && !PAGING_PAGE_SWAPPED(pte))
+#define PAGING_PAGE_RESERVED(pte)    (!PAGING_PAGE_PRESENT(pte) && ((pte) & PAGING_PTE_RESERVE_MASK))
 
 /* User number (not used in this example) */
 #define PAGING_PTE_USRNUM_LOBIT 15
@@ -71,6 +88,29 @@
 #define PAGING_SWP_LOBIT NBITS(PAGING_PAGESZ)
 #define PAGING_SWP_HIBIT (NBITS(PAGING_MEMSWPSZ) - 1)
 #define PAGING_SWP(pte) (((pte) & PAGING_PTE_SWPOFF_MASK) >> PAGING_SWPFPN_OFFSET)
+#define PAGING_SWPTYP(pte) GETVAL((pte), PAGING_PTE_SWPTYP_MASK, PAGING_PTE_SWPTYP_LOBIT)
+#define PAGING_SWPENT_MASK (PAGING_PTE_PRESENT_MASK | PAGING_PTE_SWAPPED_MASK | \
+                            PAGING_PTE_SWPTYP_MASK | PAGING_PTE_SWPOFF_MASK)
+
+/*===========================================================================
+ * Page Replacement Policies
+ *===========================================================================*/
+/* Hooks run on the page replacement state of a mm:
+ *   on_map      : page became online (mapped or swapped in)
+ *   on_access   : online page was accessed
+ *   on_unmap    : page left the address space, forget it
+ *   pick_victim : choose an online page to evict and stop tracking it online
+ */
+struct pgrepl_ops {
+   const char *name;
+   void (*on_map)(struct pgrepl_state *st, int pgn);
+   void (*on_access)(struct pgrepl_state *st, int pgn);
+   void (*on_unmap)(struct pgrepl_state *st, int pgn);
+   int (*pick_victim)(struct pgrepl_state *st, int *pgn);
+};
+
+extern const struct pgrepl_ops *pgrepl_policy;
+extern const struct pgrepl_ops *pgrepl_policies[];
 
 /*===========================================================================
  * Value Operators
@@ -93,6 +133,85 @@
 #define PAGING_PGN(x)    GETVAL((x), PAGING_PGN_MASK, PAGING_ADDR_PGN_LOBIT)
 #define PAGING_FPN(x)    GETVAL((x), PAGING_PTE_FPN_MASK, PAGING_PTE_FPN_LOBIT)
 
+/*===========================================================================
+ * Paging Statistics
+ *===========================================================================*/
+struct mm_stats {
+   unsigned long pgfault;     /* pages brought back from MEMSWP */
+   unsigned long pgswpout;    /* pages written out to MEMSWP */
+   unsigned long pgminflt;    /* first touch of a reserved page */
+   long pgreserved;           /* reserved pages not touched yet */
+   unsigned long pgclean;     /* evictions dropping a clean page, no copy */
+   long swpinuse;             /* swap slots in use */
+   long swpmaxuse;            /* peak of swpinuse */
+   unsigned long swpcachehit; /* evictions reusing the slot of the swap cache */
+   unsigned long swpreclaim;  /* swap cache slots freed when swap ran full */
+   unsigned long rapages;     /* pages brought in by swap-in readahead */
+   unsigned long rahit;       /* read ahead pages accessed afterwards */
+   unsigned long rawaste;     /* read ahead pages evicted untouched */
+   unsigned long pgsteal_inline; /* evictions done by a faulting process */
+   unsigned long pgsteal_bg;  /* evictions done by the reclaim thread */
+   unsigned long kswapd_wake; /* reclaim rounds below the low watermark */
+   unsigned long pgsteal_global; /* evictions from another process */
+   unsigned long commitfail;  /* allocations over the commit limit */
+   unsigned long oomkill;     /* processes killed out of memory */
+   unsigned long rgfit;       /* allocations served by a free region */
+   unsigned long rgsbrk;      /* allocations that grew sbrk */
+   unsigned long sbrkbytes;   /* bytes sbrk grew by */
+   unsigned long rgmerge;     /* free regions coalesced */
+   unsigned long fragsum;     /* fragmentation per mille, summed on free */
+   unsigned long nfrag;       /* fragmentation samples */
+   unsigned long fragpeak;
+   uint64_t faultns;          /* time spent in page faults */
+   unsigned long pgfilein;    /* pages of a mapped file read in */
+   unsigned long pgfileout;   /* dirty pages written back to their file */
+   unsigned long shmmap;      /* shared pages found resident on a fault */
+   unsigned long shmswpout;   /* shared pages swapped out of every mapper */
+   unsigned long shmswpin;    /* shared pages brought back from MEMSWP */
+   unsigned long shmzero;     /* shared pages zero-filled on first touch */
+   unsigned long shmbusy;     /* shared victims skipped, a mapper was busy */
+   unsigned long nfork;       /* address spaces duplicated by fork */
+   unsigned long cowshare;    /* frames shared by fork instead of copied */
+   unsigned long cowcopy;     /* writes copying a shared frame */
+   unsigned long cowreuse;    /* writes finding the frame no longer shared */
+   unsigned long cowdrop;     /* shared frames swapped out of one mm only */
+   unsigned long ksmpass;     /* merging passes */
+   unsigned long ksmscan;     /* pages hashed by the merging thread */
+   unsigned long ksmmerge;    /* pages pointed at a merged frame */
+   unsigned long ksmfullscan; /* rounds over every registered process */
+   uint64_t ksmns;            /* time spent merging */
+   unsigned long memdump;     /* MEMPHY_dump() calls */
+   unsigned long memdumpfrm;  /* frames they compared or printed */
+   uint64_t memdumpns;        /* time spent dumping */
+   uint64_t devinitns;        /* time spent setting MEMRAM and MEMSWP up */
+};
+
+extern struct mm_stats mmstat;
+extern pthread_mutex_t mmstat_lock;
+
+/* Counters are bumped atomically, mmstat_lock only guards the peaks */
+#define MMSTAT_ADD(field, n) \
+        __atomic_fetch_add(&mmstat.field, (n), __ATOMIC_RELAXED)
+
+/*===========================================================================
+ * Page Access Trace
+ *===========================================================================*/
+/* A trace file holds a PGTRACE_MAGIC, PGTRACE_VERSION header followed by
+ * one 32-bit record per page access: pgn, write flag and pid
+ */
+#define PGTRACE_MAGIC      0x52544750   /* "PGTR" */
+#define PGTRACE_VERSION    1
+#define PGTRACE_PGN_MASK   GENMASK(13, 0)
+#define PGTRACE_WRITE_MASK BIT(14)
+#define PGTRACE_PID_LOBIT  15
+
+#define PGTRACE_REC(pid, pgn, wr) \
+        (((uint32_t)(pid) << PGTRACE_PID_LOBIT) | ((wr) ? PGTRACE_WRITE_MASK : 0) | \
+         ((uint32_t)(pgn) & PGTRACE_PGN_MASK))
+#define PGTRACE_PID(rec)   ((rec) >> PGTRACE_PID_LOBIT)
+#define PGTRACE_PGN(rec)   ((rec) & PGTRACE_PGN_MASK)
+#define PGTRACE_WRITE(rec) (((rec) & PGTRACE_WRITE_MASK) != 0)
+
 /*===========================================================================
  * VM Region and Paging Function Prototypes
  *===========================================================================*/
@@ -106,19 +225,36 @@ int enlist_pgn_node(struct pgn_t **pgnlist, int pgn);
 int vmap_page_range(struct pcb_t *caller, int addr, int pgnum, 
                     struct framephy_struct *frames, struct vm_rg_struct *ret_rg);
 int vm_map_ram(struct pcb_t *caller, int astart, int send, int mapstart, int incpgnum, struct vm_rg_struct *ret_rg);
+int vm_reserve_ram(struct pcb_t *caller, int mapstart, int incpgnum);
+int pg_alloc_frame(struct pcb_t *caller, int *fpn);
+int pg_unmap(struct pcb_t *caller, int pgn);
+int __free_pcb_memph(struct pcb_t *caller);
+int free_pcb_memph(struct pcb_t *caller);
 int alloc_pages_range(struct pcb_t *caller, int incpgnum, struct framephy_struct **frm_lst);
 int __swap_cp_page(struct memphy_struct *mpsrc, int srcfpn,
                    struct memphy_struct *mpdst, int dstfpn);
 int pte_set_fpn(uint32_t *pte, int fpn);
 int pte_set_swap(uint32_t *pte, int swptyp, int swpoff);
+int pte_set_reserve(uint32_t *pte);
 int init_pte(uint32_t *pte, int pre, int fpn, int drt, int swp, int swptyp, int swpoff);
 int __alloc(struct pcb_t *caller, int vmaid, int rgid, int size, int *alloc_addr);
 int __free(struct pcb_t *caller, int vmaid, int rgid);
 int __read(struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE *data);
 int __write(struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE value);
+int __read_range(struct pcb_t *caller, int vmaid, int rgid, int offset,
+                 BYTE *buf, int len);
+int __write_range(struct pcb_t *caller, int vmaid, int rgid, int offset,
+                  const BYTE *buf, int len);
+int __memset_range(struct pcb_t *caller, int vmaid, int rgid, int offset,
+                   BYTE value, int len);
 int init_mm(struct mm_struct *mm, struct pcb_t *caller);
+int free_mm(struct mm_struct *mm);
 
 /* VM Prototypes */
+extern int vm_lazy_alloc;
+extern int vm_overcommit_ratio;
+extern long vm_commit_limit;
+extern long vm_committed;
 int pgalloc(struct pcb_t *proc, uint32_t size, uint32_t reg_index);
 int pgfree_data(struct pcb_t *proc, uint32_t reg_index);
 int pgread(struct pcb_t *proc, uint32_t source, uint32_t offset, uint32_t destination);
@@ -126,19 +262,147 @@ int pgwrite(struct pcb_t *proc, BYTE data, uint32_t destination, uint32_t offset
 
 /* Local VM Prototypes */
 struct vm_rg_struct * get_symrg_byid(struct mm_struct *mm, int rgid);
+struct vm_rg_struct * symrg_add(struct mm_struct *mm, int rgid);
+int symrg_del(struct mm_struct *mm, int rgid);
+void symrg_destroy(struct mm_struct *mm);
 int validate_overlap_vm_area(struct pcb_t *caller, int vmaid, int vmastart, int vmaend);
 int get_free_vmrg_area(struct pcb_t *caller, int vmaid, int size, struct vm_rg_struct *newrg);
 int inc_vma_limit(struct pcb_t *caller, int vmaid, int inc_sz);
+int vm_freerg_insert(struct vm_area_struct *vma, unsigned long start, unsigned long end);
+int vm_freerg_take(struct vm_area_struct *vma, unsigned long size, struct vm_rg_struct *newrg);
+long vm_freerg_take_top(struct vm_area_struct *vma);
+long vm_freerg_take_bottom(struct vm_area_struct *vma);
+int vm_freerg_frag(struct vm_area_struct *vma);
 int find_victim_page(struct mm_struct *mm, int *pgn);
+int __mm_evict_page(struct pcb_t *caller, int *fpn);
 struct vm_area_struct * get_vma_by_num(struct mm_struct *mm, int vmaid);
+struct vm_area_struct * get_vma_by_addr(struct mm_struct *mm, unsigned long addr);
+int vm_area_add(struct mm_struct *mm, unsigned long start, unsigned long end,
+                unsigned long flags);
+int vm_area_del(struct mm_struct *mm, int vmaid);
+long vm_mmap_gap(struct mm_struct *mm, unsigned long len);
+int vm_mmap_area(struct pcb_t *caller, int len, int file);
+
+/* File backed mmap areas */
+int mmfile_open(int file, const char *path);
+long mmfile_size(int file);
+int mmfile_extend(int file, long size);
+void mmfile_close_all(void);
+int vm_file_readpage(struct vm_area_struct *vma, int pgn,
+                     struct memphy_struct *mram, int fpn);
+int vm_file_writepage(struct vm_area_struct *vma, int pgn,
+                      struct memphy_struct *mram, int fpn);
+
+/* Shared memory segments */
+int shm_get(int key, int size);
+int shm_attach(struct pcb_t *caller, int key);
+int shm_detach(struct pcb_t *caller, int vmaid);
+int __shm_detach(struct pcb_t *caller, struct vm_area_struct *vma);
+int shm_fault(struct pcb_t *caller, struct vm_area_struct *vma, int pgn, int *fpn);
+int shm_evict(struct pcb_t *caller, struct vm_area_struct *vma, int pgn, int fpn);
+int shm_fork_map(struct pcb_t *child, struct vm_area_struct *vma);
+int print_shm_stats(void);
+
+/* Copy-on-write fork */
+int vm_fork_mm(struct pcb_t *parent, struct pcb_t *child);
+int vm_cow_fault(struct pcb_t *caller, int pgn, int *fpn);
+int vm_cow_swapout(struct pcb_t *caller, int pgn);
+void vm_fork_report(struct pcb_t *proc);
+
+/* Page replacement prototypes */
+const struct pgrepl_ops *pgrepl_lookup(const char *name);
+int pgrepl_select(const char *name);
+struct pgrepl_state *pgrepl_create(const struct pgrepl_ops *ops, uint32_t *pgd, int cap);
+void pgrepl_destroy(struct pgrepl_state *st);
+void pgrepl_on_map(struct pgrepl_state *st, int pgn);
+void pgrepl_on_access(struct pgrepl_state *st, int pgn);
+void pgrepl_on_unmap(struct pgrepl_state *st, int pgn);
+int pgrepl_pick_victim(struct pgrepl_state *st, int *pgn);
+
+/* Background reclaim */
+struct timer_id_t;
+
+struct kswapd_args {
+   struct timer_id_t *timer_id;
+   struct memphy_struct *mram;
+};
+
+extern int kswapd_enabled;
+extern int kswapd_wmark_low;
+extern int kswapd_wmark_high;
+int kswapd_register(struct pcb_t *proc);
+int kswapd_unregister(struct pcb_t *proc);
+void *kswapd_routine(void *args);
+void kswapd_stop(void);
+int reclaim_global_page(struct pcb_t *caller, int *fpn);
+int oom_kill(struct pcb_t *caller);
+int reclaim_registry_get(struct pcb_t ***procs);
+void reclaim_registry_put(void);
+
+/* Same-page merging */
+extern int ksm_enabled;
+extern int ksm_pages;
+extern int ksm_sleep;
+void *ksm_routine(void *args);
+void ksm_stop(void);
+
+/* Swap slot prototypes */
+extern int swap_ra_max;
+int swap_init(struct memphy_struct *mp, int swptyp);
+int swap_alloc(struct memphy_struct *mp, int *slot);
+int swap_get_slot(struct memphy_struct *mram, int *swptyp, int *slot);
+int swap_readpage(struct memphy_struct *mp, int slot,
+                  struct memphy_struct *mram, int fpn);
+int swap_writepage(struct memphy_struct *mram, int fpn,
+                   struct memphy_struct *mp, int slot);
+int swap_dup(struct memphy_struct *mp, int slot);
+int swap_free(struct memphy_struct *mp, int slot);
+int swap_cache_add(struct memphy_struct *mp, int slot,
+                   struct memphy_struct *mram, int fpn, uint32_t swpent);
+int swap_cache_lookup(struct memphy_struct *mp, int slot);
+uint32_t swap_cache_take(struct memphy_struct *mram, int fpn);
+int swap_cache_reclaim(struct memphy_struct *mp, struct memphy_struct *mram);
+int print_swap_stats(void);
+
+/* Compressed swap pool prototypes */
+struct zpool *zpool_create(int nslots);
+int zpool_store(struct zpool *zp, int slot, const BYTE *page);
+int zpool_load(struct zpool *zp, int slot, BYTE *page);
+void zpool_free(struct zpool *zp, int slot);
+int zpool_print_stats(struct zpool *zp);
+
+/* Page access trace prototypes */
+int pgtrace_open(const char *path);
+void pgtrace_record(int pid, int pgn, int wr);
+int pgtrace_close(void);
+int pgtrace_load(const char *path, uint32_t **recs, long *nrec);
 
 /* Memory/Physical prototypes */
+#define MEMPHY_DUMP_OFF  0
+#define MEMPHY_DUMP_DIFF 1   /* bytes changed since the last dump */
+#define MEMPHY_DUMP_FULL 2   /* every frame holding non-zero bytes */
+extern int memphy_dump_mode;
+extern __thread double memphy_iowait;
 int MEMPHY_get_freefp(struct memphy_struct *mp, int *fpn);
 int MEMPHY_put_freefp(struct memphy_struct *mp, int fpn);
+int MEMPHY_get_frame(struct memphy_struct *mp, int fpn);
+int MEMPHY_frame_refs(struct memphy_struct *mp, int fpn);
+int MEMPHY_free_frames(struct memphy_struct *mp);
 int MEMPHY_read(struct memphy_struct *mp, int addr, BYTE *value);
 int MEMPHY_write(struct memphy_struct *mp, int addr, BYTE data);
+int MEMPHY_read_range(struct memphy_struct *mp, int addr, BYTE *buf, int len);
+int MEMPHY_write_range(struct memphy_struct *mp, int addr, const BYTE *buf, int len);
+int MEMPHY_read_page(struct memphy_struct *mp, int fpn, BYTE *buf);
+int MEMPHY_write_page(struct memphy_struct *mp, int fpn, const BYTE *buf);
 int MEMPHY_dump(struct memphy_struct *mp);
+int MEMPHY_dump_select(const char *name);
+int MEMPHY_zero_frame(struct memphy_struct *mp, int fpn);
+int MEMPHY_set_swpcopy(struct memphy_struct *mp, int fpn, uint32_t swpent);
+uint32_t MEMPHY_get_swpcopy(struct memphy_struct *mp, int fpn);
 int init_memphy(struct memphy_struct *mp, int max_size, int randomflg);
+int init_memphy_backend(struct memphy_struct *mp, int max_size, int randomflg,
+                        int kind, const char *path);
+uint64_t memphy_clock_ns(void);
 
 /* Print Functions */
 int print_list_fp(struct framephy_struct *fp);
@@ -146,5 +410,6 @@ int print_list_rg(struct vm_rg_struct *rg);
 int print_list_vma(struct vm_area_struct *vma);
 int print_list_pgn(struct pgn_t *ip);
 int print_pgtbl(struct pcb_t *ip, uint32_t start, uint32_t end);
+int print_mm_stats(void);
 
 #endif /* MM_H */
\ No newline at end of file
@@ -5,6 +5,22 @@
 #define MAX_PRIO 140
 
 #define MM_PAGING
+/* Default page replacement policy, overridden by "pgrepl" in config:
+ * fifo, clock, lru, 2q, arc */
+#define MM_PGREPL "clock"
+/* Largest swap-in readahead window in pages, overridden by "swapra" in
+ * config, 0 disables readahead */
+#define MM_SWAPRA 8
+/* Background reclaim thread, overridden by "kswapd" in config */
+#define MM_KSWAPD 1
+/* Same-page merging thread, overridden by "ksm" in config */
+#define MM_KSM 0
+/* Commit limit in percent of RAM plus swap, overridden by "overcommit" in
+ * config, 0 disables the limit */
+#define MM_OVERCOMMIT 100
+/* MEMRAM content dump after each read and write under IODUMP, overridden
+ * by "memdump" in config: off, diff, full */
+#define MM_MEMDUMP "diff"
 //#define MM_FIXED_MEMSZ
 //#define VMDBG 1
 //#define MMDBG 1
@@ -1,20 +1,59 @@
 #ifndef OSMM_H
 #define OSMM_H
 
+#include <sys/types.h> /* pthread_mutex_t, pthread.h would pull in our sched.h */
 
 #define MM_PAGING
 #define PAGING_MAX_MMSWP 4 /* max number of supported swapped space */
-#define PAGING_MAX_SYMTBL_SZ 30
 
 typedef char BYTE;
 typedef uint32_t addr_t;
 //typedef unsigned int uint32_t;
 
+struct shm_seg;
+
 struct pgn_t{
    int pgn;
    struct pgn_t *pg_next; 
 };
 
+/*
+ *  Page replacement bookkeeping
+ *  A node is kept per tracked page (online, or a ghost entry remembered
+ *  by 2Q/ARC), looked up through a chained hash on pgn and linked into
+ *  one of the policy lists.
+ */
+#define PGREPL_NLIST 4
+
+struct pgrepl_node {
+   int pgn;
+   int list;
+   struct pgrepl_node *prev;
+   struct pgrepl_node *next;
+   struct pgrepl_node *hnext;
+};
+
+struct pgrepl_list {
+   struct pgrepl_node *head;
+   struct pgrepl_node *tail;
+   int len;
+};
+
+struct pgrepl_state {
+   const struct pgrepl_ops *ops;
+   uint32_t *pgd;          /* page table holding the accessed bits */
+
+   struct pgrepl_node **htbl;
+   int hsize;
+   int hcount;
+
+   struct pgrepl_list lst[PGREPL_NLIST];
+   int nres;               /* online pages tracked */
+   int cap;                /* cache size the policy adapts to */
+   int fixedcap;           /* cap given by owner, else online high-water */
+   int p;                  /* ARC target size of T1 */
+};
+
 /*
  *  Memory region struct
  */
@@ -23,8 +62,38 @@ struct vm_rg_struct {
    unsigned long rg_end;
 
    struct vm_rg_struct *rg_next;
+
+   /* Free regions only: previous by address, the size bin links, and the
+    * AVL tree by address */
+   struct vm_rg_struct *rg_prev;
+   struct vm_rg_struct *bin_next;
+   struct vm_rg_struct *bin_prev;
+   struct vm_rg_struct *rg_left;
+   struct vm_rg_struct *rg_right;
+   int rg_height;
+   unsigned long rg_maxsz;    /* largest free region of the subtree */
 };
 
+/* Size bins of the free regions of a VMA, bin b holds sizes in
+ * [2^(b+5), 2^(b+6)) bytes, the first and last bins are open ended */
+#define VM_FREERG_NBINS 16
+
+/*
+ *  Symbol region table slot, keyed by region id
+ */
+struct vm_symrg {
+   int rgid;
+   int used;
+   struct vm_rg_struct rg;
+};
+
+/* Flags of a memory area: the stack grows down from its break at
+ * vm_start, an mmap area never grows, a shared one maps a segment of
+ * shared memory (mm-shm.c) */
+#define VM_GROWSDOWN 0x1
+#define VM_MMAP      0x2
+#define VM_SHARED    0x4
+
 /*
  *  Memory area struct
  */
@@ -32,6 +101,9 @@ struct vm_area_struct {
    unsigned long vm_id;
    unsigned long vm_start;
    unsigned long vm_end;
+   unsigned long vm_flags;
+   int vm_file;               /* mapped host file, 0 for anonymous memory */
+   struct shm_seg *vm_shm;    /* mapped shared memory segment */
 
    unsigned long sbrk;
 /*
@@ -39,23 +111,64 @@ struct vm_area_struct {
  * unsigned long vm_limit = vm_end - vm_start
  */
    struct mm_struct *vm_mm;
-   struct vm_rg_struct *vm_freerg_list;
+   struct vm_rg_struct *vm_freerg_list;  /* address ordered, coalesced */
+   struct vm_rg_struct *vm_freerg_tail;
+   struct vm_rg_struct *vm_freerg_root;  /* the same regions, by address */
+   unsigned long vm_freerg_bytes;
+   struct vm_rg_struct *vm_freerg_bins[VM_FREERG_NBINS];
    struct vm_area_struct *vm_next;
 };
 
 /* 
  * Memory management struct
  */
+/*
+ *  Memory locks, always taken in this order:
+ *    1. mm_struct.lock of the process doing the operation
+ *    2. the reclaim registry lock (mm-kswapd.c) or a shared memory segment
+ *       lock (mm-shm.c), then the mm_struct.lock of another process, only
+ *       with pthread_mutex_trylock()
+ *    3. memphy_struct.lock of a swap device, it also covers the swpcopy
+ *       entries of MEMRAM that refer to its slots
+ *    4. memphy_struct.lock of MEMRAM
+ *    5. leaf locks: zpool, statistics, trace
+ */
 struct mm_struct {
+   /* VMAs, regions, page table and replacement state */
+   pthread_mutex_t lock;
+
    uint32_t *pgd;
 
    struct vm_area_struct *mmap;
 
-   /* Currently we support a fixed number of symbol */
-   struct vm_rg_struct symrgtbl[PAGING_MAX_SYMTBL_SZ];
-
-   /* list of free page */
-   struct pgn_t *fifo_pgn;
+   /* The VMAs of mmap indexed by id, and sorted by address */
+   struct vm_area_struct **vma_byid;
+   int vma_nid;
+   struct vm_area_struct **vma_byaddr;
+   int vma_cnt;
+
+   /* Symbol regions by region id, see mm-symrg.c. No table until the
+    * first allocation */
+   struct vm_symrg *symrgtbl;
+   int symrg_cap;
+   int symrg_cnt;
+
+   /* Page replacement state of the online pages */
+   struct pgrepl_state *pgrepl;
+
+   /* Swap-in readahead: where a sequential fault is expected next, and
+    * the current window in pages */
+   int ra_next;
+   int ra_win;
+
+   /* Pages charged against the commit limit */
+   int committed;
+
+   /* Copy-on-write: frames shared by fork with another mm, and the
+    * writes to such pages, copying the frame or not */
+   int cow_shared;
+   int cow_faults;
+   int cow_copies;
 };
 
 /*
@@ -69,18 +182,68 @@ struct framephy_struct {
    struct mm_struct* owner;
 };
 
+/* MEMPHY storage backends */
+#define MEMPHY_MEM  0   /* host memory */
+#define MEMPHY_MMAP 1   /* sparse file mapped into host memory */
+#define MEMPHY_FILE 2   /* sparse file accessed with pread/pwrite */
+#define MEMPHY_ZRAM 3   /* compressed pages in host memory, swap only */
+
+struct zpool;
+
 struct memphy_struct {
    /* Basic field of data and size */
-   BYTE *storage;
+   BYTE *storage;       /* NULL for MEMPHY_FILE and MEMPHY_ZRAM */
    int maxsz;
+   int kind;
+   int fd;
+   struct zpool *zpool; /* MEMPHY_ZRAM pages */
+   uint64_t inittime;   /* ns spent setting the device up */
    
+   /* Free frames, swap slots and the cursor */
+   pthread_mutex_t lock;
+
    /* Sequential device fields */ 
    int rdmflg;
    int cursor;
+   double seeklat;      /* time slots per MiB the cursor travels */
+   double xferlat;      /* time slots per page transferred */
+   unsigned long nseek;
+   unsigned long seekdist; /* bytes travelled by all the seeks */
+   double iolat;        /* time slots spent in all */
 
    /* Management structure */
    struct framephy_struct *free_fp_list;
    struct framephy_struct *used_fp_list;
+   int nfreefp;         /* length of free_fp_list */
+
+   /* Swap entry still holding a clean copy of each frame, 0 if none */
+   uint32_t *swpcopy;
+
+   /* MEMRAM: references held on each frame, more than one for the frames
+    * of shared memory */
+   uint16_t *frmref;
+
+   /* Content tracking for MEMPHY_dump(): frames written since the last
+    * dump, also listed in the order first written, and frames that may
+    * hold non-zero bytes */
+   pthread_mutex_t dumplock;
+   uint32_t *dirtymap;
+   uint32_t *usedmap;
+   int *dirtylist;
+   int ndirty;
+   BYTE **shadow;       /* frame contents at the last dump, NULL if zero */
+
+   /* Swap slot management, set up by swap_init() on swap devices */
+   uint32_t *slotmap;   /* bitmap of used slots */
+   uint16_t *slotref;   /* references held on each slot */
+   int *slotfrm;        /* swap cache: frame holding the slot plus 1, 0 if
+                         * none, so that untouched slots cost no memory */
+   int nslots;
+   int scanpos;         /* next-fit position of swap_alloc() */
+   int reclaimpos;      /* resume position of swap_cache_reclaim() */
+   unsigned long pgin;  /* pages read from the swap device */
+   unsigned long pgout; /* pages written to the swap device */
+   uint64_t iotime;     /* ns spent in page I/O on the swap device */
 };
 
 #endif
@@ -23,6 +23,13 @@ void put_proc(struct pcb_t * proc);
 /* Add a new process to ready queue */
 void add_proc(struct pcb_t * proc);
 
+/* Add a process forked by the running one to ready queue, -1 unless
+ * there is room for it and for its parent when put back */
+int add_forked_proc(struct pcb_t * proc);
+
+/* Whether add_forked_proc() would fail now */
+int forked_queue_full(struct pcb_t * proc);
+
 #endif
 
 
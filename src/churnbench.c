@@ -0,0 +1,195 @@
+/*
+ * Process churn benchmark
+ *
+ * Runs many short-lived processes through the memory manager, a few of
+ * them live at a time: each one allocates and writes a heap region, every
+ * fourth one forks a child that writes part of it again, then both are
+ * torn down the way cpu_routine() does. MEMRAM is small, so pages are
+ * evicted to MEMSWP and shared copy-on-write meanwhile.
+ *
+ * Every tenth of the run the free frames, swap slots and heap bytes in use
+ * are reported. Once all processes are gone every frame and slot must be
+ * free again, no page left reserved and the heap back to where it stood at the first report.
+ *
+ * Usage: churnbench [processes] [pages per process]
+ */
+
+#include "mm.h"
+#include "common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <time.h>
+
+#define CHURN_DEFAULT_NPROC 100000
+#define CHURN_DEFAULT_NPAGE 8
+#define CHURN_LIVE 8
+#define CHURN_RAM_FRAMES 32
+#define CHURN_SWP_SLOTS 1024
+/* Heap bytes the run may grow by between the first and the last report,
+ * tables sized by the largest number of live processes */
+#define CHURN_HEAP_SLACK (64 * 1024)
+
+static struct memphy_struct mram, mswp;
+static struct memphy_struct *mswpv[PAGING_MAX_MMSWP];
+static uint32_t churn_pid = 1;
+
+static double elapsed(struct timespec *t0)
+{
+  struct timespec t1;
+
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  return (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+static struct pcb_t *churn_new(void)
+{
+  struct pcb_t *proc = calloc(1, sizeof(struct pcb_t));
+
+  if (proc == NULL)
+    return NULL;
+  proc->pid = churn_pid++;
+  proc->mram = &mram;
+  proc->mswp = mswpv;
+  proc->active_mswp = &mswp;
+  proc->mm = malloc(sizeof(struct mm_struct));
+  if (proc->mm == NULL || init_mm(proc->mm, proc) != 0)
+  {
+    free(proc->mm);
+    free(proc);
+    return NULL;
+  }
+  kswapd_register(proc);
+
+  return proc;
+}
+
+static struct pcb_t *churn_fork(struct pcb_t *parent)
+{
+  struct pcb_t *child = malloc(sizeof(struct pcb_t));
+
+  if (child == NULL)
+    return NULL;
+  memcpy(child, parent, sizeof(struct pcb_t));
+  child->pid = churn_pid++;
+  child->mm = malloc(sizeof(struct mm_struct));
+  if (child->mm == NULL || vm_fork_mm(parent, child) != 0)
+  {
+    free(child->mm);
+    free(child);
+    return NULL;
+  }
+  kswapd_register(child);
+
+  return child;
+}
+
+/* What cpu_routine() does with a finished process */
+static void churn_exit(struct pcb_t *proc)
+{
+  kswapd_unregister(proc);
+  free_pcb_memph(proc);
+  free_mm(proc->mm);
+  free(proc->mm);
+  free(proc);
+}
+
+static int churn_write(struct pcb_t *proc, int npage, BYTE val)
+{
+  int pg, nfail = 0;
+
+  for (pg = 0; pg < npage; pg++)
+    nfail += (__write(proc, 0, 0, pg * PAGING_PAGESZ, val + pg) != 0);
+
+  return nfail;
+}
+
+static void report(long nproc, double secs)
+{
+  printf("%8ld processes %9.3f ms  free frames %3d/%d  swap slots %3ld  "
+         "heap %8zu bytes\n", nproc, secs * 1e3, MEMPHY_free_frames(&mram),
+         CHURN_RAM_FRAMES, mmstat.swpinuse, mallinfo2().uordblks);
+}
+
+int main(int argc, char *argv[])
+{
+  struct pcb_t *live[CHURN_LIVE] = { NULL };
+  struct pcb_t *child;
+  struct timespec t0;
+  long nproc = CHURN_DEFAULT_NPROC, i;
+  int npage = CHURN_DEFAULT_NPAGE, addr, nfail = 0, k;
+  size_t heap0 = 0, heap1;
+
+  if (argc > 1)
+    nproc = atol(argv[1]);
+  if (argc > 2)
+    npage = atoi(argv[2]);
+  if (nproc <= 0 || npage <= 0 || npage > 255)
+  {
+    printf("Usage: churnbench [processes] [pages per process]\n");
+    return 1;
+  }
+
+  init_memphy(&mram, CHURN_RAM_FRAMES * PAGING_PAGESZ, 1);
+  init_memphy(&mswp, CHURN_SWP_SLOTS * PAGING_PAGESZ, 1);
+  swap_init(&mswp, 0);
+  for (k = 0; k < PAGING_MAX_MMSWP; k++)
+    mswpv[k] = &mswp;
+
+  printf("%ld processes of %d pages, %d live, %d frames\n",
+         nproc, npage, CHURN_LIVE, CHURN_RAM_FRAMES);
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (i = 0; i < nproc; i++)
+  {
+    k = i % CHURN_LIVE;
+    if (live[k] != NULL)
+      churn_exit(live[k]);
+
+    if ((live[k] = churn_new()) == NULL ||
+        __alloc(live[k], 0, 0, npage * PAGING_PAGESZ, &addr) != 0)
+    {
+      nfail++;
+      continue;
+    }
+    nfail += churn_write(live[k], npage, (BYTE)i);
+
+    if (i % 4 == 0)
+    {
+      if ((child = churn_fork(live[k])) == NULL)
+        nfail++;
+      else
+      {
+        nfail += churn_write(child, npage / 2, (BYTE)(i + 1));
+        churn_exit(child);
+      }
+    }
+
+    if ((i + 1) % (nproc / 10 > 0 ? nproc / 10 : 1) == 0)
+    {
+      report(i + 1, elapsed(&t0));
+      if (heap0 == 0)
+        heap0 = mallinfo2().uordblks;
+    }
+  }
+
+  for (k = 0; k < CHURN_LIVE; k++)
+    if (live[k] != NULL)
+      churn_exit(live[k]);
+  heap1 = mallinfo2().uordblks;
+  report(nproc, elapsed(&t0));
+
+  if (nfail != 0 || MEMPHY_free_frames(&mram) != CHURN_RAM_FRAMES ||
+      mmstat.swpinuse != 0 || vm_committed != 0 || mmstat.pgreserved != 0 ||
+      heap1 > heap0 + CHURN_HEAP_SLACK)
+  {
+    printf("%d operations failed, %d frames and %ld swap slots leaked, "
+           "%ld pages committed, %ld reserved, heap %zu -> %zu bytes\n", nfail,
+           CHURN_RAM_FRAMES - MEMPHY_free_frames(&mram), mmstat.swpinuse,
+           vm_committed, mmstat.pgreserved, heap0, heap1);
+    return 1;
+  }
+
+  return 0;
+}
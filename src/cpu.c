@@ -76,7 +76,7 @@ switch (ins.opcode)
 		break;
 	case ALLOC:
 #ifdef MM_PAGING
-		stat = liballoc(proc, ins.arg_0, ins.arg_1);
+		stat = liballoc(proc, ins.arg_0, ins.arg_1, ins.arg_2);
 #else
 		stat = alloc(proc, ins.arg_0, ins.arg_1);
 #endif
@@ -105,6 +105,22 @@ switch (ins.opcode)
 	case SYSCALL:
 		stat = libsyscall(proc, ins.arg_0, ins.arg_1, ins.arg_2, ins.arg_3);
 		break;
+#ifdef MM_PAGING
+	/* Ranges go through the paging path a page at a time */
+	case READW:
+		stat = libread_word(proc, ins.arg_0, ins.arg_1, &ins.arg_2);
+		break;
+	case WRITEW:
+		stat = libwrite_word(proc, ins.arg_0, ins.arg_1, ins.arg_2);
+		break;
+	case MEMSET:
+		stat = libmemset(proc, ins.arg_0, ins.arg_1, ins.arg_2, ins.arg_3);
+		break;
+	case MEMCPY:
+		stat = libmemcpy(proc, ins.arg_0, ins.arg_1, ins.arg_2, ins.arg_3,
+		                 ins.arg_4);
+		break;
+#endif
 	default:
 		stat = 1;
 	}
@@ -0,0 +1,143 @@
+/*
+ * Byte and range access benchmark
+ *
+ * Writes then reads back a region of one process through the paging path,
+ * once a byte at a time with __write()/__read() and once a range at a time
+ * with __write_range()/__read_range(), which translate each page once. It
+ * runs with MEMRAM holding the whole region, then with a quarter of it so
+ * that pages go to MEMSWP and back. Both paths must read back what they
+ * wrote.
+ *
+ * Usage: iobench [region size] [range size]
+ */
+
+#include "mm.h"
+#include "common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define IOBENCH_DEFAULT_SIZE (256 * 1024)
+#define IOBENCH_DEFAULT_RANGE 4096
+
+static struct memphy_struct mram, mswp;
+static struct memphy_struct *mswpv[PAGING_MAX_MMSWP];
+
+static double elapsed(struct timespec *t0)
+{
+  struct timespec t1;
+
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  return (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+static void report(const char *what, long nbyte, double secs)
+{
+  printf("%-24s %9ld bytes %9.3f ms %8.1f MB/s\n",
+         what, nbyte, secs * 1e3, secs > 0 ? nbyte / secs / 1e6 : 0.0);
+}
+
+static BYTE pattern(int i)
+{
+  return (BYTE)(i * 7 + (i >> 8));
+}
+
+/* One pass of each path with nframe frames of MEMRAM, return failures */
+static int run(int size, int range, int nframe)
+{
+  struct pcb_t proc;
+  struct timespec t0;
+  BYTE *buf = malloc(range);
+  BYTE val;
+  int i, n, addr, nfail = 0;
+
+  memset(&proc, 0, sizeof(proc));
+  init_memphy(&mram, nframe * PAGING_PAGESZ, 1);
+  init_memphy(&mswp, 2 * size, 1);
+  swap_init(&mswp, 0);
+  for (i = 0; i < PAGING_MAX_MMSWP; i++)
+    mswpv[i] = &mswp;
+  proc.pid = 1;
+  proc.mram = &mram;
+  proc.mswp = mswpv;
+  proc.active_mswp = &mswp;
+  proc.mm = malloc(sizeof(struct mm_struct));
+  if (buf == NULL || proc.mm == NULL || init_mm(proc.mm, &proc) != 0 ||
+      __alloc(&proc, 0, 0, size, &addr) != 0)
+  {
+    printf("Cannot set up a region of %d bytes\n", size);
+    return 1;
+  }
+
+  printf("%d frames of MEMRAM, %d pages in the region\n",
+         nframe, DIV_ROUND_UP(size, PAGING_PAGESZ));
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (i = 0; i < size; i++)
+    nfail += (__write(&proc, 0, 0, i, pattern(i)) != 0);
+  report("  write per byte", size, elapsed(&t0));
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (i = 0; i < size; i++)
+    nfail += (__read(&proc, 0, 0, i, &val) != 0 || val != pattern(i));
+  report("  read per byte", size, elapsed(&t0));
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (i = 0; i < size; i += range)
+  {
+    n = (size - i < range) ? size - i : range;
+    for (addr = 0; addr < n; addr++)
+      buf[addr] = pattern(i + addr) ^ 0xff;
+    nfail += (__write_range(&proc, 0, 0, i, buf, n) != n);
+  }
+  report("  write range", size, elapsed(&t0));
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (i = 0; i < size; i += range)
+  {
+    n = (size - i < range) ? size - i : range;
+    nfail += (__read_range(&proc, 0, 0, i, buf, n) != n);
+    for (addr = 0; addr < n; addr++)
+      nfail += (buf[addr] != (BYTE)(pattern(i + addr) ^ 0xff));
+  }
+  report("  read range", size, elapsed(&t0));
+
+  free_pcb_memph(&proc);
+  free_mm(proc.mm);
+  free(proc.mm);
+  free(buf);
+
+  return nfail;
+}
+
+int main(int argc, char *argv[])
+{
+  int size = IOBENCH_DEFAULT_SIZE, range = IOBENCH_DEFAULT_RANGE;
+  int npage, nfail;
+
+  if (argc > 1)
+    size = atoi(argv[1]);
+  if (argc > 2)
+    range = atoi(argv[2]);
+  if (size <= 0 || range <= 0 || size > BIT(PAGING_CPU_BUS_WIDTH) / 2)
+  {
+    printf("Usage: iobench [region size] [range size]\n");
+    return 1;
+  }
+
+  vm_lazy_alloc = 1;
+  npage = DIV_ROUND_UP(size, PAGING_PAGESZ);
+  printf("Region of %d bytes, ranges of %d bytes\n", size, range);
+
+  nfail = run(size, range, npage);
+  nfail += run(size, range, npage / 4 > 0 ? npage / 4 : 1);
+
+  if (nfail != 0)
+  {
+    printf("%d accesses failed or read back wrong\n", nfail);
+    return 1;
+  }
+
+  return 0;
+}
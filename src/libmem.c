@@ -21,41 +21,40 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <pthread.h>
+#include <sys/resource.h>
 
-static pthread_mutex_t mmvm_lock = PTHREAD_MUTEX_INITIALIZER;
 
-/*enlist_vm_freerg_list - add new rg to freerg_list
- *@mm: memory region
- *@rg_elmt: new region
- *
- */
-int enlist_vm_freerg_list(struct mm_struct *mm, struct vm_rg_struct *rg_elmt)
-{
-  struct vm_rg_struct *rg_node = mm->mmap->vm_freerg_list;
-
-  if (rg_elmt->rg_start >= rg_elmt->rg_end)
-    return -1;
-
-  if (rg_node != NULL)
-    rg_elmt->rg_next = rg_node;
-
-  /* Enlist the new region */
-  mm->mmap->vm_freerg_list = rg_elmt;
+/* Paging event counters, reported by print_mm_stats() */
+struct mm_stats mmstat;
+pthread_mutex_t mmstat_lock = PTHREAD_MUTEX_INITIALIZER;
 
-  return 0;
+/* Sample the fragmentation of a VMA after a free */
+static void vm_free_stat_frag(struct vm_area_struct *vma)
+{
+  unsigned long frag = vm_freerg_frag(vma);
+
+  pthread_mutex_lock(&mmstat_lock);
+  mmstat.fragsum += frag;
+  mmstat.nfrag++;
+  if (frag > mmstat.fragpeak)
+    mmstat.fragpeak = frag;
+  pthread_mutex_unlock(&mmstat_lock);
 }
 
-/*get_symrg_byid - get mem region by region ID
+/*enlist_vm_freerg_list - add the range of rg to freerg_list
  *@mm: memory region
- *@rgid: region ID act as symbol index of variable
+ *@rg_elmt: new region, left to the caller
  *
+ * The range goes back to the vm area holding it.
  */
-struct vm_rg_struct *get_symrg_byid(struct mm_struct *mm, int rgid)
+int enlist_vm_freerg_list(struct mm_struct *mm, struct vm_rg_struct *rg_elmt)
 {
-  if (rgid < 0 || rgid > PAGING_MAX_SYMTBL_SZ)
-    return NULL;
+  struct vm_area_struct *vma = get_vma_by_addr(mm, rg_elmt->rg_start);
 
-  return &mm->symrgtbl[rgid];
+  if (vma == NULL || rg_elmt->rg_start >= rg_elmt->rg_end)
+    return -1;
+
+  return vm_freerg_insert(vma, rg_elmt->rg_start, rg_elmt->rg_end);
 }
 
 /*__alloc - allocate a region memory
@@ -70,47 +69,86 @@ int __alloc(struct pcb_t *caller, int vmaid, int rgid, int size, int *alloc_addr
 {
   /*Allocate at the toproof */
   struct vm_rg_struct rgnode;
+  struct vm_rg_struct *symrg;
+  struct vm_area_struct *cur_vma;
+
+  pthread_mutex_lock(&caller->mm->lock);
 
-  /* TODO: commit the vmaid */
-  // rgnode.vmaid
+  cur_vma = get_vma_by_num(caller->mm, vmaid);
+  if (caller->oom_killed || cur_vma == NULL)
+  {
+    pthread_mutex_unlock(&caller->mm->lock);
+    return -1;
+  }
+
+ // The symbol table entry first, so that nothing is left to undo after
+  symrg = symrg_add(caller->mm, rgid);
+  if (symrg == NULL)
+  {
+    pthread_mutex_unlock(&caller->mm->lock);
+    return -1;
+  }
 
   if (get_free_vmrg_area(caller, vmaid, size, &rgnode) == 0)
   {
-    caller->mm->symrgtbl[rgid].rg_start = rgnode.rg_start;
-    caller->mm->symrgtbl[rgid].rg_end = rgnode.rg_end;
+    symrg->rg_start = rgnode.rg_start;
+    symrg->rg_end = rgnode.rg_end;
  
     *alloc_addr = rgnode.rg_start;
 
-    pthread_mutex_unlock(&mmvm_lock);
+    MMSTAT_ADD(rgfit, 1);
+    pthread_mutex_unlock(&caller->mm->lock);
     return 0;
   }
   
   // get_free_vmrg_area FAILED: handle region management (Fig.6)
-  // Retrieve the current vm area:
-  struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
-
-  // Align the increment size to a page boundary:
-  int inc_sz = PAGING_PAGE_ALIGNSZ(size);
 
   // Save old sbrk (the current break):
   int old_sbrk = cur_vma->sbrk;
+  int growsdown = (cur_vma->vm_flags & VM_GROWSDOWN) != 0;
+
+  // A free region ending at the break is extended rather than left behind,
+  // for the stack the one starting at the break
+  long edge = growsdown ? vm_freerg_take_bottom(cur_vma) : vm_freerg_take_top(cur_vma);
+  int start = growsdown ? ((edge >= 0) ? edge : old_sbrk) - size
+                        : ((edge >= 0) ? edge : old_sbrk);
+
+  // Align the increment size to a page boundary:
+  int inc_sz = growsdown ? PAGING_PAGE_ALIGNSZ(old_sbrk - start)
+                         : PAGING_PAGE_ALIGNSZ(start + size - old_sbrk);
 
   // Increase the limit invoking system call with SYSMEM_INC_OP.
   // Here we use the wrapper inc_vma_limit to perform the system call.
   int inc_limit_ret = inc_vma_limit(caller, vmaid, inc_sz);
   if (inc_limit_ret < 0)
   {
-      pthread_mutex_unlock(&mmvm_lock);
+      if (edge >= 0 && growsdown)
+        vm_freerg_insert(cur_vma, old_sbrk, edge);
+      else if (edge >= 0)
+        vm_freerg_insert(cur_vma, edge, old_sbrk);
+      if (symrg->rg_start >= symrg->rg_end)
+        symrg_del(caller->mm, rgid);
+      pthread_mutex_unlock(&caller->mm->lock);
       return -1;  // Failed to increase the limit.
   }
 
   // Commit the new limit in the vma structure:
-  cur_vma->sbrk = old_sbrk + inc_sz;
-
-  // Commit the allocation address as the old sbrk value:
-  *alloc_addr = old_sbrk;
-
-  pthread_mutex_unlock(&mmvm_lock);
+  cur_vma->sbrk = growsdown ? old_sbrk - inc_sz : old_sbrk + inc_sz;
+
+  // Commit the allocation address:
+  symrg->rg_start = start;
+  symrg->rg_end = start + size;
+  *alloc_addr = start;
+
+  // Keep the page-alignment slack for later allocations
+  if (growsdown)
+    vm_freerg_insert(cur_vma, cur_vma->sbrk, start);
+  else
+    vm_freerg_insert(cur_vma, start + size, cur_vma->sbrk);
+
+  MMSTAT_ADD(rgsbrk, 1);
+  MMSTAT_ADD(sbrkbytes, inc_sz);
+  pthread_mutex_unlock(&caller->mm->lock);
   return 0;
 }
 
@@ -120,6 +158,7 @@ int __alloc(struct pcb_t *caller, int vmaid, int rgid, int size, int *alloc_addr
  *@rgid: memory region ID (used to identify variable in symbole table)
  *@size: allocated size
  *
+ * The range goes back to the vm area holding it, whatever vmaid.
  */
 int __free(struct pcb_t *caller, int vmaid, int rgid)
 {
@@ -129,27 +168,35 @@ int __free(struct pcb_t *caller, int vmaid, int rgid)
   // in incompleted TODO code rgnode will overwrite through implementing
   // the manipulation of rgid later
 
-  if(rgid < 0 || rgid > PAGING_MAX_SYMTBL_SZ)
+  if(rgid < 0)
     return -1;
 
+  pthread_mutex_lock(&caller->mm->lock);
+
   // Retrieve the memory region corresponding to rgid.
   struct vm_rg_struct *region = get_symrg_byid(caller->mm, rgid);
-  if (region == NULL)
-      return -1;
 
   // Check if the region is valid (allocated).
-  if (region->rg_start == -1 || region->rg_end == -1 || region->rg_start >= region->rg_end)
+  if (region == NULL || region->rg_start == -1 || region->rg_end == -1 ||
+      region->rg_start >= region->rg_end)
+  {
+      pthread_mutex_unlock(&caller->mm->lock);
       return -1;
+  }
 
-  // Enlist the freed memory region into the free region list.
+  // Give the range back to the free regions
   if (enlist_vm_freerg_list(caller->mm, region) != 0)
+  {
+      pthread_mutex_unlock(&caller->mm->lock);
       return -1;
+  }
+
+  vm_free_stat_frag(get_vma_by_addr(caller->mm, region->rg_start));
 
-  // Reset the region in the symbol table.
-  region->rg_start = -1;
-  region->rg_end = -1;
-  region->rg_next = NULL;
+  // Drop the region from the symbol table.
+  symrg_del(caller->mm, rgid);
 
+  pthread_mutex_unlock(&caller->mm->lock);
   return 0;
 }
 
@@ -157,12 +204,12 @@ int __free(struct pcb_t *caller, int vmaid, int rgid)
  *@proc:  Process executing the instruction
  *@size: allocated size
  *@reg_index: memory region ID (used to identify variable in symbole table)
+ *@vmaid: vm area: VMA_HEAP_ID, VMA_STACK_ID or an mmap area
  */
-int liballoc(struct pcb_t *proc, uint32_t size, uint32_t reg_index)
+int liballoc(struct pcb_t *proc, uint32_t size, uint32_t reg_index, uint32_t vmaid)
 {
-  /* TODO Implement allocation on vm area 0 */
   int addr;
-  int ret = __alloc(proc, 0, reg_index, size, &addr);
+  int ret = __alloc(proc, vmaid, reg_index, size, &addr);
 
 #ifdef IODUMP
   if(ret == 0)
@@ -188,6 +235,89 @@ int libfree(struct pcb_t *proc, uint32_t reg_index)
     return ret;
 }
 
+/*pg_swapin - bring a swapped page back into MEMRAM
+ *@mm: memory region
+ *@pgn: PGN of a swapped page
+ *@caller: caller
+ *
+ */
+static int pg_swapin(struct mm_struct *mm, int pgn, struct pcb_t *caller)
+{
+  uint32_t pte = mm->pgd[pgn];
+  struct memphy_struct *swp = caller->mswp[PAGING_SWPTYP(pte)];
+  int tgtfpn = PAGING_SWP(pte);
+  int frmfpn;
+
+  if (pg_alloc_frame(caller, &frmfpn) != 0)
+    return -1;
+
+  /* Copy the target page from MEMSWP into the frame, the slot stays in
+   * the swap cache as a valid copy until the page is written. A slot
+   * shared by fork is left to the other mm, the frame is a private copy */
+  swap_readpage(swp, tgtfpn, caller->mram, frmfpn);
+  if (pte & PAGING_PTE_COW_MASK)
+  {
+    swap_free(swp, tgtfpn);
+    CLRBIT(mm->pgd[pgn], PAGING_PTE_COW_MASK);
+    SETBIT(mm->pgd[pgn], PAGING_PTE_DIRTY_MASK);
+  }
+  else
+    swap_cache_add(swp, tgtfpn, caller->mram, frmfpn,
+                   pte & PAGING_SWPENT_MASK);
+
+  /* Drop the swap location and point the entry at the frame */
+  CLRBIT(mm->pgd[pgn], PAGING_PTE_SWPTYP_MASK | PAGING_PTE_SWPOFF_MASK);
+  pte_set_fpn(&mm->pgd[pgn], frmfpn);
+  pgrepl_on_map(mm->pgrepl, pgn);
+
+  return 0;
+}
+
+/*pg_swapin_readahead - after a sequential fault, bring in the swapped
+ *                      pages that follow within the readahead window
+ *@mm: memory region
+ *@pgn: PGN of the faulting page
+ *@caller: caller
+ *
+ * A fault is sequential when it lands at or shortly after the page
+ * following the last fault and its readahead. The window grows as read
+ * ahead pages get used and shrinks as they are evicted untouched, and
+ * never takes more than half of the online pages of the process.
+ */
+static void pg_swapin_readahead(struct mm_struct *mm, int pgn, struct pcb_t *caller)
+{
+  int i, n = 0, win;
+
+  if (swap_ra_max <= 0 || pgn < mm->ra_next || pgn > mm->ra_next + mm->ra_win)
+  {
+    mm->ra_next = pgn + 1;
+    return;
+  }
+
+  if (mm->ra_win == 0)
+    mm->ra_win = (swap_ra_max < 2) ? swap_ra_max : 2;
+  win = (mm->ra_win < mm->pgrepl->cap / 2) ? mm->ra_win : mm->pgrepl->cap / 2;
+
+  for (i = 1; i <= win && pgn + i < PAGING_MAX_PGN; i++)
+  {
+    uint32_t pte = mm->pgd[pgn + i];
+
+    if (!PAGING_PAGE_PRESENT(pte) || !PAGING_PAGE_SWAPPED(pte))
+      break;
+    if (pg_swapin(mm, pgn + i, caller) != 0)
+      break;
+    if (PAGING_PAGE_SWAPPED(mm->pgd[pgn]))
+      break; /* the faulting page itself was taken for the window */
+
+    /* Referenced once so that CLOCK does not take it before its use */
+    SETBIT(mm->pgd[pgn + i], PAGING_PTE_RAHEAD_MASK | PAGING_PTE_ACCESSED_MASK);
+    n++;
+  }
+
+  mm->ra_next = pgn + 1 + n;
+  MMSTAT_ADD(rapages, n);
+}
+
 /*pg_getpage - get the page in ram
  *@mm: memory region
  *@pagenum: PGN
@@ -198,42 +328,74 @@ int libfree(struct pcb_t *proc, uint32_t reg_index)
 int pg_getpage(struct mm_struct *mm, int pgn, int *fpn, struct pcb_t *caller)
 {
   uint32_t pte = mm->pgd[pgn];
+  uint64_t t0 = memphy_clock_ns();
 
-  if (!PAGING_PAGE_PRESENT(pte))
-  { /* Page is not online, bring it into MEMRAM */
-      int vicpgn, swpfpn;
-
-      /* Find a victim page in MEMRAM to swap out */
-      if (find_victim_page(caller->mm, &vicpgn) != 0)
-          return -1;
+  if (PAGING_PAGE_RESERVED(pte))
+  { /* First touch of a reserved page, give it a zero-filled frame, the
+     * content of the page in a mapped file, or the frame of a shared
+     * page */
+    struct vm_area_struct *vma = get_vma_by_addr(mm, pgn * PAGING_PAGESZ);
+    int frmfpn;
 
-      /* Get a free frame number in swap area */
-      if (MEMPHY_get_freefp(caller->active_mswp, &swpfpn) != 0)
-          return -1;
+    if (vma != NULL && vma->vm_shm != NULL)
+    {
+      if (shm_fault(caller, vma, pgn, &frmfpn) != 0)
+        return -1;
+    }
+    else if (pg_alloc_frame(caller, &frmfpn) != 0)
+      return -1;
+    else if (vma != NULL && vma->vm_file != 0)
+    {
+      if (vm_file_readpage(vma, pgn, caller->mram, frmfpn) != 0)
+      {
+        MEMPHY_put_freefp(caller->mram, frmfpn);
+        return -1;
+      }
+    }
+    else
+    {
+      MEMPHY_zero_frame(caller->mram, frmfpn);
+      MMSTAT_ADD(pgminflt, 1);
+    }
 
-      /* Swap the victim page from MEMRAM to MEMSWP.
-        * This call will exchange the contents of the victim frame (vicpgn)
-        * with the free swap frame (swpfpn). */
-      if (__mm_swap_page(caller, vicpgn, swpfpn) != 0)
-          return -1;
+    CLRBIT(mm->pgd[pgn], PAGING_PTE_RESERVE_MASK);
+    MMSTAT_ADD(pgreserved, -1);
+    pte_set_fpn(&mm->pgd[pgn], frmfpn);
+    pgrepl_on_map(mm->pgrepl, pgn);
 
-      /* Retrieve the target frame number stored in swap from the page table
-        * (assume the swap frame is encoded in the page table entry). */
-      int tgtfpn = PAGING_SWP(pte); // Macro: extract swap frame number
+    MMSTAT_ADD(faultns, memphy_clock_ns() - t0);
+  }
+  else if (!PAGING_PAGE_PRESENT(pte))
+    return -1; /* Page is not mapped */
+  else if (PAGING_PAGE_SWAPPED(pte))
+  { /* Page is not online, bring it into MEMRAM */
+    if (pg_swapin(mm, pgn, caller) != 0)
+      return -1;
 
-      /* Now swap the target page from MEMSWP back into MEMRAM,
-        * using the frame freed by the victim swap (vicpgn). */
-      if (__mm_swap_page(caller, tgtfpn, vicpgn) != 0)
-          return -1;
+    /* Keep the faulting page from being picked by its own readahead */
+    SETBIT(mm->pgd[pgn], PAGING_PTE_ACCESSED_MASK);
+    pg_swapin_readahead(mm, pgn, caller);
 
-    /* Update the page table entry to mark the page as present in MEMRAM.
-    * Clear the old frame bits and set the new frame (vicpgn) along with the present flag. */
-    mm->pgd[pgn] = (mm->pgd[pgn] & ~PAGING_PTE_FPN_MASK) | vicpgn | PAGING_PTE_PRESENT_MASK;
-}
+    /* Under pressure readahead may push the faulting page out again */
+    if (PAGING_PAGE_SWAPPED(mm->pgd[pgn]) && pg_swapin(mm, pgn, caller) != 0)
+      return -1;
 
-*fpn = PAGING_FPN(mm->pgd[pgn]);
-return 0;
+    MMSTAT_ADD(pgfault, 1);
+    MMSTAT_ADD(faultns, memphy_clock_ns() - t0);
+  }
+  else
+  {
+    if (pte & PAGING_PTE_RAHEAD_MASK)
+    { /* Readahead hit, widen the window */
+      CLRBIT(mm->pgd[pgn], PAGING_PTE_RAHEAD_MASK);
+      mm->ra_win = (mm->ra_win * 2 < swap_ra_max) ? mm->ra_win * 2 : swap_ra_max;
+      MMSTAT_ADD(rahit, 1);
+    }
+    pgrepl_on_access(mm->pgrepl, pgn);
+  }
 
+  *fpn = PAGING_FPN(mm->pgd[pgn]);
+  return 0;
 }
 
 /*pg_getval - read value at given offset
@@ -248,10 +410,14 @@ int pg_getval(struct mm_struct *mm, int addr, BYTE *data, struct pcb_t *caller)
   int off = PAGING_OFFST(addr);
   int fpn;
 
+  pgtrace_record(caller->pid, pgn, 0);
+
   /* Get the page to MEMRAM, swap from MEMSWAP if needed */
   if (pg_getpage(mm, pgn, &fpn, caller) != 0)
     return -1; /* invalid page access */
 
+  SETBIT(mm->pgd[pgn], PAGING_PTE_ACCESSED_MASK);
+
   /* Calculate physical address using the frame number and offset */
   int phyaddr = fpn * PAGING_PAGESZ + off;
 
@@ -277,10 +443,18 @@ int pg_setval(struct mm_struct *mm, int addr, BYTE value, struct pcb_t *caller)
   int off = PAGING_OFFST(addr);  // assumes macro extracts offset within page
   int fpn;
 
+  pgtrace_record(caller->pid, pgn, 1);
+
   /* Bring the page into MEMRAM, swapping from MEMSWAP if needed */
   if (pg_getpage(mm, pgn, &fpn, caller) != 0)
       return -1;  /* invalid page access */
 
+  /* First write to a page shared by fork */
+  if ((mm->pgd[pgn] & PAGING_PTE_COW_MASK) && vm_cow_fault(caller, pgn, &fpn) != 0)
+      return -1;
+
+  SETBIT(mm->pgd[pgn], PAGING_PTE_ACCESSED_MASK | PAGING_PTE_DIRTY_MASK);
+
   /* Calculate physical address using the frame number and offset */
   int phyaddr = fpn * PAGING_PAGESZ + off;
 
@@ -301,16 +475,22 @@ int pg_setval(struct mm_struct *mm, int addr, BYTE value, struct pcb_t *caller)
  *@rgid: memory region ID (used to identify variable in symbole table)
  *@size: allocated size
  *
+ * The access must fall in one of the vm areas, looked up by address.
  */
 int __read(struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE *data)
 {
-  struct vm_rg_struct *currg = get_symrg_byid(caller->mm, rgid);
-  struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
+  struct vm_rg_struct *currg;
 
-  if (currg == NULL || cur_vma == NULL) /* Invalid memory identify */
+  pthread_mutex_lock(&caller->mm->lock);
+  currg = get_symrg_byid(caller->mm, rgid);
+  if (currg == NULL || caller->oom_killed || /* Invalid memory identify */
+      get_vma_by_addr(caller->mm, currg->rg_start + offset) == NULL ||
+      pg_getval(caller->mm, currg->rg_start + offset, data, caller) != 0)
+  {
+    pthread_mutex_unlock(&caller->mm->lock);
     return -1;
-
-  pg_getval(caller->mm, currg->rg_start + offset, data, caller);
+  }
+  pthread_mutex_unlock(&caller->mm->lock);
 
   return 0;
 }
@@ -322,11 +502,10 @@ int libread(
     uint32_t offset,    // Source address = [source] + [offset]
     uint32_t* destination)
 {
-  BYTE data;
+  BYTE data = 0;
   int val = __read(proc, 0, source, offset, &data);
 
-  /* TODO update result of reading action*/
-  //destination 
+  *destination = data;
 #ifdef IODUMP
   printf("read region=%d offset=%d value=%d\n", source, offset, data);
 #ifdef PAGETBL_DUMP
@@ -345,16 +524,22 @@ int libread(
  *@rgid: memory region ID (used to identify variable in symbole table)
  *@size: allocated size
  *
+ * The access must fall in one of the vm areas, looked up by address.
  */
 int __write(struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE value)
 {
-  struct vm_rg_struct *currg = get_symrg_byid(caller->mm, rgid);
-  struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
+  struct vm_rg_struct *currg;
 
-  if (currg == NULL || cur_vma == NULL) /* Invalid memory identify */
+  pthread_mutex_lock(&caller->mm->lock);
+  currg = get_symrg_byid(caller->mm, rgid);
+  if (currg == NULL || caller->oom_killed || /* Invalid memory identify */
+      get_vma_by_addr(caller->mm, currg->rg_start + offset) == NULL ||
+      pg_setval(caller->mm, currg->rg_start + offset, value, caller) != 0)
+  {
+    pthread_mutex_unlock(&caller->mm->lock);
     return -1;
-
-  pg_setval(caller->mm, currg->rg_start + offset, value, caller);
+  }
+  pthread_mutex_unlock(&caller->mm->lock);
 
   return 0;
 }
@@ -366,42 +551,399 @@ int libwrite(
     uint32_t destination, // Index of destination register
     uint32_t offset)
 {
+  int val;
+
 #ifdef IODUMP
   printf("write region=%d offset=%d value=%d\n", destination, offset, data);
 #ifdef PAGETBL_DUMP
   print_pgtbl(proc, 0, -1); //print max TBL
 #endif
+#endif
+  val = __write(proc, 0, destination, offset, data);
+#ifdef IODUMP
   MEMPHY_dump(proc->mram);
 #endif
 
-  return __write(proc, 0, destination, offset, data);
+  return val;
 }
 
-/*free_pcb_memphy - collect all memphy of pcb
+/* Range access modes of __rw_range() */
+#define RANGE_READ  0
+#define RANGE_WRITE 1
+#define RANGE_FILL  2   /* write the one page of buf over and over */
+
+/*pg_rwrange - read or write bytes within one page
+ *@mm: memory region
+ *@addr: virtual address to acess
+ *@buf: bytes
+ *@len: bytes to move, up to the end of the page of addr
+ *@write: write buf, read into it otherwise
+ *
+ */
+static int pg_rwrange(struct mm_struct *mm, int addr, BYTE *buf, int len,
+                      int write, struct pcb_t *caller)
+{
+  int pgn = PAGING_PGN(addr);
+  int fpn;
+
+  pgtrace_record(caller->pid, pgn, write);
+
+  /* Bring the page into MEMRAM, swapping from MEMSWAP if needed */
+  if (pg_getpage(mm, pgn, &fpn, caller) != 0)
+    return -1;
+
+  if (!write)
+  {
+    SETBIT(mm->pgd[pgn], PAGING_PTE_ACCESSED_MASK);
+    return MEMPHY_read_range(caller->mram, fpn * PAGING_PAGESZ + PAGING_OFFST(addr),
+                             buf, len);
+  }
+
+  /* First write to a page shared by fork */
+  if ((mm->pgd[pgn] & PAGING_PTE_COW_MASK) && vm_cow_fault(caller, pgn, &fpn) != 0)
+    return -1;
+
+  SETBIT(mm->pgd[pgn], PAGING_PTE_ACCESSED_MASK | PAGING_PTE_DIRTY_MASK);
+  return MEMPHY_write_range(caller->mram, fpn * PAGING_PAGESZ + PAGING_OFFST(addr),
+                            buf, len);
+}
+
+/*__rw_range - move bytes of a region memory a page at a time
+ *@caller: caller
+ *@rgid: memory region ID
+ *@offset: offset of the first byte in the region
+ *@buf: bytes, one page of them in RANGE_FILL mode
+ *@len: bytes to move
+ *@mode: RANGE_READ, RANGE_WRITE or RANGE_FILL
+ *
+ * Each page is translated once, faulted in if needed, and its part of the
+ * range copied in one go. Return the bytes moved, short of len when a page
+ * falls out of the vm areas or cannot be brought in, -1 for an invalid
+ * region.
+ */
+static int __rw_range(struct pcb_t *caller, int rgid, int offset, BYTE *buf,
+                      int len, int mode)
+{
+  struct vm_rg_struct *currg;
+  int addr, n, done = 0;
+
+  pthread_mutex_lock(&caller->mm->lock);
+  currg = get_symrg_byid(caller->mm, rgid);
+  if (currg == NULL || caller->oom_killed)
+  {
+    pthread_mutex_unlock(&caller->mm->lock);
+    return -1;
+  }
+
+  while (done < len)
+  {
+    addr = currg->rg_start + offset + done;
+    n = PAGING_PAGESZ - PAGING_OFFST(addr);
+    if (n > len - done)
+      n = len - done;
+
+    if (get_vma_by_addr(caller->mm, addr) == NULL ||
+        get_vma_by_addr(caller->mm, addr + n - 1) == NULL ||
+        pg_rwrange(caller->mm, addr, (mode == RANGE_FILL) ? buf : buf + done,
+                   n, mode != RANGE_READ, caller) != 0)
+      break;
+    done += n;
+  }
+  pthread_mutex_unlock(&caller->mm->lock);
+
+  return done;
+}
+
+/*__read_range - read bytes of a region memory
  *@caller: caller
  *@vmaid: ID vm area to alloc memory region
- *@incpgnum: number of page
+ *@rgid: memory region ID (used to identify variable in symbole table)
+ *@offset: offset to acess in memory region
+ *@buf: returned bytes
+ *@len: bytes to read
+ *
+ * Return the bytes read, see __rw_range().
  */
-int free_pcb_memph(struct pcb_t *caller)
+int __read_range(struct pcb_t *caller, int vmaid, int rgid, int offset,
+                 BYTE *buf, int len)
+{
+  return __rw_range(caller, rgid, offset, buf, len, RANGE_READ);
+}
+
+/*__write_range - write bytes of a region memory
+ *@caller: caller
+ *@vmaid: ID vm area to alloc memory region
+ *@rgid: memory region ID (used to identify variable in symbole table)
+ *@offset: offset to acess in memory region
+ *@buf: bytes to write
+ *@len: bytes to write
+ *
+ * Return the bytes written, see __rw_range().
+ */
+int __write_range(struct pcb_t *caller, int vmaid, int rgid, int offset,
+                  const BYTE *buf, int len)
+{
+  return __rw_range(caller, rgid, offset, (BYTE *)buf, len, RANGE_WRITE);
+}
+
+/*__memset_range - fill bytes of a region memory with a value
+ *
+ * Return the bytes written, see __rw_range().
+ */
+int __memset_range(struct pcb_t *caller, int vmaid, int rgid, int offset,
+                   BYTE value, int len)
+{
+  BYTE page[PAGING_PAGESZ];
+
+  memset(page, value, PAGING_PAGESZ);
+  return __rw_range(caller, rgid, offset, page, len, RANGE_FILL);
+}
+
+/*libread_range - PAGING-based read of bytes of a region memory
+ *
+ * Return the bytes read, short when the region ends before len.
+ */
+int libread_range(
+    struct pcb_t *proc, // Process executing the instruction
+    uint32_t source,    // Index of source register
+    uint32_t offset,    // Source address = [source] + [offset]
+    BYTE *buf,
+    uint32_t len)
+{
+  int val = __read_range(proc, 0, source, offset, buf, len);
+
+#ifdef IODUMP
+  printf("read region=%d offset=%d size=%d, %d bytes read\n",
+         source, offset, len, val);
+#ifdef PAGETBL_DUMP
+  print_pgtbl(proc, 0, -1); //print max TBL
+#endif
+  MEMPHY_dump(proc->mram);
+#endif
+
+  return val;
+}
+
+/*libwrite_range - PAGING-based write of bytes to a region memory
+ *
+ * Return the bytes written, short when the region ends before len.
+ */
+int libwrite_range(
+    struct pcb_t *proc,   // Process executing the instruction
+    const BYTE *buf,      // Data to be wrttien into memory
+    uint32_t destination, // Index of destination register
+    uint32_t offset,
+    uint32_t len)
+{
+  int val;
+
+#ifdef IODUMP
+  printf("write region=%d offset=%d size=%d\n", destination, offset, len);
+#ifdef PAGETBL_DUMP
+  print_pgtbl(proc, 0, -1); //print max TBL
+#endif
+#endif
+  val = __write_range(proc, 0, destination, offset, buf, len);
+#ifdef IODUMP
+  MEMPHY_dump(proc->mram);
+#endif
+
+  return val;
+}
+
+/*libread_word - PAGING-based read of a 32-bit little-endian word */
+int libread_word(
+    struct pcb_t *proc, // Process executing the instruction
+    uint32_t source,    // Index of source register
+    uint32_t offset,    // Source address = [source] + [offset]
+    uint32_t *destination)
+{
+  BYTE buf[4] = { 0 };
+  int val = __read_range(proc, 0, source, offset, buf, 4);
+
+  *destination = (uint8_t)buf[0] | (uint8_t)buf[1] << 8 |
+                 (uint8_t)buf[2] << 16 | (uint32_t)(uint8_t)buf[3] << 24;
+#ifdef IODUMP
+  printf("read region=%d offset=%d word=%u\n", source, offset, *destination);
+#ifdef PAGETBL_DUMP
+  print_pgtbl(proc, 0, -1); //print max TBL
+#endif
+  MEMPHY_dump(proc->mram);
+#endif
+
+  return (val == 4) ? 0 : -1;
+}
+
+/*libwrite_word - PAGING-based write of a 32-bit little-endian word */
+int libwrite_word(
+    struct pcb_t *proc,   // Process executing the instruction
+    uint32_t data,        // Data to be wrttien into memory
+    uint32_t destination, // Index of destination register
+    uint32_t offset)
+{
+  BYTE buf[4] = { data & 0xff, (data >> 8) & 0xff, (data >> 16) & 0xff, data >> 24 };
+  int val;
+
+#ifdef IODUMP
+  printf("write region=%d offset=%d word=%u\n", destination, offset, data);
+#ifdef PAGETBL_DUMP
+  print_pgtbl(proc, 0, -1); //print max TBL
+#endif
+#endif
+  val = __write_range(proc, 0, destination, offset, buf, 4);
+#ifdef IODUMP
+  MEMPHY_dump(proc->mram);
+#endif
+
+  return (val == 4) ? 0 : -1;
+}
+
+/*libmemset - PAGING-based fill of bytes of a region memory */
+int libmemset(
+    struct pcb_t *proc,   // Process executing the instruction
+    BYTE data,            // Value of every byte
+    uint32_t destination, // Index of destination register
+    uint32_t offset,
+    uint32_t len)
 {
-  int pagenum, fpn;
-  uint32_t pte;
+  int val;
 
+#ifdef IODUMP
+  printf("memset region=%d offset=%d size=%d value=%d\n",
+         destination, offset, len, data);
+#ifdef PAGETBL_DUMP
+  print_pgtbl(proc, 0, -1); //print max TBL
+#endif
+#endif
+  val = __memset_range(proc, 0, destination, offset, data, len);
+#ifdef IODUMP
+  MEMPHY_dump(proc->mram);
+#endif
+
+  return (val == (int)len) ? 0 : -1;
+}
+
+/*libmemcpy - PAGING-based copy between region memories
+ *
+ * The source is read whole before the destination is written, so the two
+ * may overlap.
+ */
+int libmemcpy(
+    struct pcb_t *proc,   // Process executing the instruction
+    uint32_t destination, // Index of destination register
+    uint32_t dstoffset,
+    uint32_t source,      // Index of source register
+    uint32_t srcoffset,
+    uint32_t len)
+{
+  BYTE *buf = malloc(len > 0 ? len : 1);
+  int val = -1;
 
-  for(pagenum = 0; pagenum < PAGING_MAX_PGN; pagenum++)
+#ifdef IODUMP
+  printf("memcpy region=%d offset=%d from region=%d offset=%d size=%d\n",
+         destination, dstoffset, source, srcoffset, len);
+#ifdef PAGETBL_DUMP
+  print_pgtbl(proc, 0, -1); //print max TBL
+#endif
+#endif
+  if (buf != NULL && __read_range(proc, 0, source, srcoffset, buf, len) == (int)len)
+    val = __write_range(proc, 0, destination, dstoffset, buf, len);
+  free(buf);
+#ifdef IODUMP
+  MEMPHY_dump(proc->mram);
+#endif
+
+  return (val == (int)len) ? 0 : -1;
+}
+
+/*pg_unmap - release the frame or swap slot of a page
+ *@caller: caller
+ *@pgn: PGN
+ *
+ * A dirty page of a mapped file is written back first.
+ */
+int pg_unmap(struct pcb_t *caller, int pgn)
+{
+  uint32_t pte = caller->mm->pgd[pgn];
+  int fpn;
+
+  caller->mm->pgd[pgn] = 0;
+  if (PAGING_PAGE_RESERVED(pte))
+    MMSTAT_ADD(pgreserved, -1);
+  if (!PAGING_PAGE_PRESENT(pte))
+    return 0;
+
+  if (!PAGING_PAGE_SWAPPED(pte))
   {
-    pte= caller->mm->pgd[pagenum];
+    struct vm_area_struct *vma = get_vma_by_addr(caller->mm, pgn * PAGING_PAGESZ);
+    uint32_t swpent;
+
+    fpn = PAGING_FPN(pte);
+    if (vma != NULL && vma->vm_file != 0 && (pte & PAGING_PTE_DIRTY_MASK))
+      vm_file_writepage(vma, pgn, caller->mram, fpn);
+    if ((swpent = swap_cache_take(caller->mram, fpn)) != 0)
+      swap_free(caller->mswp[PAGING_SWPTYP(swpent)], PAGING_SWP(swpent));
+    MEMPHY_put_freefp(caller->mram, fpn);
+  } else {
+    fpn = PAGING_SWP(pte);
+    swap_free(caller->mswp[PAGING_SWPTYP(pte)], fpn);
+  }
+  pgrepl_on_unmap(caller->mm->pgrepl, pgn);
 
-    if (!PAGING_PAGE_PRESENT(pte))
+  return 0;
+}
+
+/*__free_pcb_memph - collect all memphy of pcb, with the mm lock held
+ *@caller: caller
+ *
+ * Only the pages of the areas are walked, no page lies outside of one. The
+ * areas themselves stay until free_mm(), this may run twice when the OOM
+ * killer took the memory first.
+ */
+int __free_pcb_memph(struct pcb_t *caller)
+{
+  struct vm_area_struct *vma, *next;
+  int pagenum, endpgn;
+
+  /* Shared areas first, the segments drop their mappings */
+  for (vma = caller->mm->mmap; vma != NULL; vma = next)
+  {
+    next = vma->vm_next;
+    if (vma->vm_shm != NULL)
     {
-      fpn = PAGING_FPN(pte);
-      MEMPHY_put_freefp(caller->mram, fpn);
-    } else {
-      fpn = PAGING_SWP(pte);
-      MEMPHY_put_freefp(caller->active_mswp, fpn);    
+      __shm_detach(caller, vma);
+      vm_area_del(caller->mm, vma->vm_id);
     }
   }
 
+  for (vma = caller->mm->mmap; vma != NULL; vma = vma->vm_next)
+  {
+    endpgn = DIV_ROUND_UP(vma->vm_end, PAGING_PAGESZ);
+    for (pagenum = vma->vm_start / PAGING_PAGESZ;
+         pagenum < endpgn && pagenum < PAGING_MAX_PGN; pagenum++)
+      if (caller->mm->pgd[pagenum] != 0)
+        pg_unmap(caller, pagenum);
+  }
+
+  /* Give back the commit charge */
+  __atomic_sub_fetch(&vm_committed, caller->mm->committed, __ATOMIC_RELAXED);
+  caller->mm->committed = 0;
+
+  symrg_destroy(caller->mm);
+
+  return 0;
+}
+
+/*free_pcb_memphy - collect all memphy of pcb
+ *@caller: caller
+ *
+ */
+int free_pcb_memph(struct pcb_t *caller)
+{
+  pthread_mutex_lock(&caller->mm->lock);
+  __free_pcb_memph(caller);
+  pthread_mutex_unlock(&caller->mm->lock);
+
   return 0;
 }
 
@@ -413,17 +955,204 @@ int free_pcb_memph(struct pcb_t *caller)
  */
 int find_victim_page(struct mm_struct *mm, int *retpgn)
 {
-  struct pgn_t *pg = mm->fifo_pgn;
+  return pgrepl_pick_victim(mm->pgrepl, retpgn);
+}
 
-  /* TODO: Implement the theorical mechanism to find the victim page */
-  if(pg == NULL)
-    return -1;
-  
-  *retpgn = pg->pgn;
-  mm->fifo_pgn = pg->pg_next; // Move to the next page in the FIFO list  
+/*__mm_evict_page - swap a victim page of caller out to MEMSWP
+ *@caller: caller
+ *@retfpn: return the MEMRAM frame released by the victim
+ *
+ */
+int __mm_evict_page(struct pcb_t *caller, int *retfpn)
+{
+  struct mm_struct *mm = caller->mm;
+  struct vm_area_struct *vma;
+  int vicpgn, vicfpn, swptyp, swpfpn, ntry;
+  uint32_t *pte, swpent;
+
+  /* A shared page stays online while another of its mappers is busy, a
+   * frame shared by fork is not freed by the eviction: try the other
+   * pages once */
+  for (ntry = mm->pgrepl->nres; ; ntry--)
+  {
+    if (find_victim_page(mm, &vicpgn) != 0)
+      return -1;
+
+    pte = &mm->pgd[vicpgn];
+    vicfpn = PAGING_FPN(*pte);
+
+    vma = get_vma_by_addr(mm, vicpgn * PAGING_PAGESZ);
+    if (vma != NULL && vma->vm_shm != NULL)
+    {
+      if (shm_evict(caller, vma, vicpgn, vicfpn) == 0)
+      {
+        *retfpn = vicfpn;
+        return 0;
+      }
+      pgrepl_on_map(mm->pgrepl, vicpgn); /* keep the victim online */
+    }
+    else if (MEMPHY_frame_refs(caller->mram, vicfpn) > 1)
+    { /* Frame shared by fork: out of this mm only, no frame freed */
+      if (vm_cow_swapout(caller, vicpgn) != 0)
+        pgrepl_on_map(mm->pgrepl, vicpgn);
+    }
+    else
+      break;
 
-  free(pg);
+    if (ntry <= 1)
+      return -1;
+  }
 
+  if (vma != NULL && vma->vm_file != 0)
+  { /* Page of a mapped file: written back if dirty, read again on the
+     * next touch */
+    if ((*pte & PAGING_PTE_DIRTY_MASK) &&
+        vm_file_writepage(vma, vicpgn, caller->mram, vicfpn) != 0)
+    {
+      pgrepl_on_map(mm->pgrepl, vicpgn); /* keep the victim online */
+      return -1;
+    }
+    pte_set_reserve(pte);
+
+    *retfpn = vicfpn;
+    return 0;
+  }
+
+  /* The slot leaves the swap cache, its reference goes to the entry */
+  if ((swpent = swap_cache_take(caller->mram, vicfpn)) != 0)
+    MMSTAT_ADD(swpcachehit, 1);
+
+  if (*pte & PAGING_PTE_RAHEAD_MASK)
+  { /* Read ahead for nothing, narrow the window */
+    CLRBIT(*pte, PAGING_PTE_RAHEAD_MASK);
+    mm->ra_win = (mm->ra_win > 1) ? mm->ra_win / 2 : 1;
+    MMSTAT_ADD(rawaste, 1);
+  }
+
+  if (swpent != 0 && !(*pte & PAGING_PTE_DIRTY_MASK))
+  {
+    /* Clean page, its swap copy is still valid: drop the frame */
+    pte_set_swap(pte, PAGING_SWPTYP(swpent), PAGING_SWP(swpent));
+
+    MMSTAT_ADD(pgclean, 1);
+  }
+  else
+  {
+    /* Write back into the slot of a stale copy, or a free one */
+    if (swpent != 0)
+    {
+      swptyp = PAGING_SWPTYP(swpent);
+      swpfpn = PAGING_SWP(swpent);
+    }
+    else if (swap_get_slot(caller->mram, &swptyp, &swpfpn) != 0)
+    {
+      pgrepl_on_map(mm->pgrepl, vicpgn); /* keep the victim online */
+      return -1;
+    }
+
+    /* Copy the victim frame out and mark its entry as swapped */
+    swap_writepage(caller->mram, vicfpn, caller->mswp[swptyp], swpfpn);
+    pte_set_swap(pte, swptyp, swpfpn);
+
+    MMSTAT_ADD(pgswpout, 1);
+  }
+
+  CLRBIT(*pte, PAGING_PTE_DIRTY_MASK | PAGING_PTE_COW_MASK);
+
+  *retfpn = vicfpn;
+  return 0;
+}
+
+/*pg_alloc_frame - get a MEMRAM frame for caller
+ *@caller: caller
+ *@retfpn: return FPN
+ *
+ * Take a free frame, otherwise the one released by a victim page of caller,
+ * otherwise one of another process. When nothing can be swapped out, the
+ * OOM killer frees the memory of a process and the allocation is retried,
+ * unless caller itself was killed.
+ */
+int pg_alloc_frame(struct pcb_t *caller, int *retfpn)
+{
+  while (1)
+  {
+    if (MEMPHY_get_freefp(caller->mram, retfpn) == 0)
+      return 0;
+
+    if (__mm_evict_page(caller, retfpn) == 0)
+    {
+      MMSTAT_ADD(pgsteal_inline, 1);
+      return 0;
+    }
+
+    if (reclaim_global_page(caller, retfpn) == 0)
+      return 0;
+
+    if (oom_kill(caller) != 0 || caller->oom_killed)
+      return -1;
+  }
+}
+
+/*print_mm_stats - report paging counters
+ *
+ */
+int print_mm_stats(void)
+{
+  struct rusage ru;
+  unsigned long nflt;
+
+  printf("===== PAGING STATISTICS =====\n");
+  printf("Replacement policy: %s\n",
+         pgrepl_policy != NULL ? pgrepl_policy->name : MM_PGREPL);
+  printf("Page faults (swap in): %lu\n", mmstat.pgfault);
+  printf("Pages swapped out:     %lu\n", mmstat.pgswpout);
+  printf("Clean pages dropped:   %lu (%lu swap-out bytes avoided)\n",
+         mmstat.pgclean, mmstat.pgclean * PAGING_PAGESZ);
+  printf("Swap slots in use:     %ld (peak %ld)\n", mmstat.swpinuse, mmstat.swpmaxuse);
+  printf("Swap cache hits:       %lu, slots reclaimed %lu\n",
+         mmstat.swpcachehit, mmstat.swpreclaim);
+  printf("Readahead: %lu pages, %lu hits, %lu wasted (window max %d)\n",
+         mmstat.rapages, mmstat.rahit, mmstat.rawaste, swap_ra_max);
+  printf("Reclaim: %lu inline, %lu from other processes, %lu background "
+         "in %lu kswapd rounds\n", mmstat.pgsteal_inline,
+         mmstat.pgsteal_global, mmstat.pgsteal_bg, mmstat.kswapd_wake);
+  nflt = mmstat.pgfault + mmstat.pgminflt + mmstat.pgfilein +
+         mmstat.shmmap + mmstat.shmswpin + mmstat.shmzero + mmstat.cowcopy;
+  printf("Fault latency: %.2f us avg over %lu faults\n",
+         nflt > 0 ? mmstat.faultns / 1e3 / nflt : 0.0, nflt);
+  printf("Overcommit: %ld/%ld pages committed, %lu allocations refused, "
+         "%lu processes OOM killed\n", vm_committed, vm_commit_limit,
+         mmstat.commitfail, mmstat.oomkill);
+  print_swap_stats();
+  printf("Allocation mode: %s\n", vm_lazy_alloc ? "lazy" : "eager");
+  printf("Regions: %lu allocs from free regions, %lu grew sbrk by %lu bytes, "
+         "%lu merges\n", mmstat.rgfit, mmstat.rgsbrk, mmstat.sbrkbytes,
+         mmstat.rgmerge);
+  printf("Fragmentation: %.1f%% avg, %.1f%% peak over %lu frees\n",
+         mmstat.nfrag > 0 ? mmstat.fragsum / 10.0 / mmstat.nfrag : 0.0,
+         mmstat.fragpeak / 10.0, mmstat.nfrag);
+  printf("File mmap: %lu pages read in, %lu dirty pages written back\n",
+         mmstat.pgfilein, mmstat.pgfileout);
+  printf("Shared memory: %lu pages zero-filled, %lu mapped online, "
+         "%lu swapped out, %lu swapped in, %lu evictions skipped busy\n",
+         mmstat.shmzero, mmstat.shmmap, mmstat.shmswpout, mmstat.shmswpin,
+         mmstat.shmbusy);
+  print_shm_stats();
+  printf("Fork: %lu address spaces, %lu frames shared, %lu copied on write, "
+         "%lu reused, %lu swapped out of one mm\n", mmstat.nfork,
+         mmstat.cowshare, mmstat.cowcopy, mmstat.cowreuse, mmstat.cowdrop);
+  printf("Memory dumps: %lu, %lu frames visited, %.2f us avg\n",
+         mmstat.memdump, mmstat.memdumpfrm,
+         mmstat.memdump > 0 ? mmstat.memdumpns / 1e3 / mmstat.memdump : 0.0);
+  getrusage(RUSAGE_SELF, &ru);
+  printf("Device setup: %.3f ms, peak RSS %ld KiB\n",
+         mmstat.devinitns / 1e6, ru.ru_maxrss);
+  printf("KSM: %lu pages scanned in %lu passes, %lu merged, %lu full scans, "
+         "%.2f us avg per pass\n", mmstat.ksmscan, mmstat.ksmpass,
+         mmstat.ksmmerge, mmstat.ksmfullscan,
+         mmstat.ksmpass > 0 ? mmstat.ksmns / 1e3 / mmstat.ksmpass : 0.0);
+  printf("Minor faults (first touch): %lu\n", mmstat.pgminflt);
+  printf("Reserved pages untouched:   %ld\n", mmstat.pgreserved);
   return 0;
 }
 
@@ -445,29 +1174,8 @@ int get_free_vmrg_area(struct pcb_t *caller, int vmaid, int size, struct vm_rg_s
   /* Probe unintialized newrg */
   newrg->rg_start = newrg->rg_end = -1;
 
-  /* TODO Traverse on list of free vm region to find a fit space */
-  struct vm_rg_struct *prev = NULL;
-  while (rgit != NULL) {
-    int avail = rgit->rg_end - rgit->rg_start;
-    if (avail >= size) {
-        newrg->rg_start = rgit->rg_start;
-        newrg->rg_end = newrg->rg_start + size;
-        // Adjust the free region in the list
-        rgit->rg_start = newrg->rg_end;
-        if (rgit->rg_start >= rgit->rg_end) {
-            if (prev == NULL)
-                cur_vma->vm_freerg_list = rgit->rg_next;
-            else
-                prev->rg_next = rgit->rg_next;
-            free(rgit);
-        }
-        return 0;
-    }
-    prev = rgit;
-    rgit = rgit->rg_next;
-  }
-  
-  return 0;
+  /* Segregated fit over the size bins, see vm_freerg_take() */
+  return vm_freerg_take(cur_vma, size, newrg);
 }
 
 //#endif
@@ -12,6 +12,10 @@ static uint32_t avail_pid = 1;
 #define OPT_READ	"read"
 #define OPT_WRITE	"write"
 #define OPT_SYSCALL	"syscall"
+#define OPT_READW	"readw"
+#define OPT_WRITEW	"writew"
+#define OPT_MEMSET	"memset"
+#define OPT_MEMCPY	"memcpy"
 
 static enum ins_opcode_t get_opcode(char * opt) {
 	if (!strcmp(opt, OPT_CALC)) {
@@ -26,17 +30,47 @@ static enum ins_opcode_t get_opcode(char * opt) {
 		return WRITE;
 	}else if (!strcmp(opt, OPT_SYSCALL)) {
 		return SYSCALL;
+	}else if (!strcmp(opt, OPT_READW)) {
+		return READW;
+	}else if (!strcmp(opt, OPT_WRITEW)) {
+		return WRITEW;
+	}else if (!strcmp(opt, OPT_MEMSET)) {
+		return MEMSET;
+	}else if (!strcmp(opt, OPT_MEMCPY)) {
+		return MEMCPY;
 	}else{
 		printf("get_opcode return Opcode: %s\n", opt);
 		exit(1);
 	}
 }
 
+/* Copy of a process running the same code from the same instruction,
+ * the memory is left to the caller */
+struct pcb_t * clone_pcb(struct pcb_t * parent) {
+	struct pcb_t * proc = (struct pcb_t * )malloc(sizeof(struct pcb_t));
+	memcpy(proc, parent, sizeof(struct pcb_t));
+	proc->pid = __atomic_fetch_add(&avail_pid, 1, __ATOMIC_RELAXED);
+	proc->page_table =
+		(struct page_table_t*)malloc(sizeof(struct page_table_t));
+	__atomic_add_fetch(&proc->code->refs, 1, __ATOMIC_RELAXED);
+	return proc;
+}
+
+/* Release a process given by load() or clone_pcb(), its memory already
+ * collected by the caller */
+void unload(struct pcb_t * proc) {
+	if (__atomic_sub_fetch(&proc->code->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+		free(proc->code->text);
+		free(proc->code);
+	}
+	free(proc->page_table);
+	free(proc);
+}
+
 struct pcb_t * load(const char * path) {
 	/* Create new PCB for the new process */
 	struct pcb_t * proc = (struct pcb_t * )malloc(sizeof(struct pcb_t));
-	proc->pid = avail_pid;
-	avail_pid++;
+	proc->pid = __atomic_fetch_add(&avail_pid, 1, __ATOMIC_RELAXED);
 	proc->page_table =
 		(struct page_table_t*)malloc(sizeof(struct page_table_t));
 	proc->bp = PAGE_SIZE;
@@ -51,6 +85,7 @@ struct pcb_t * load(const char * path) {
 	snprintf(proc->path, 2*sizeof(path)+1, "%s", path);
 	char opcode[10];
 	proc->code = (struct code_seg_t*)malloc(sizeof(struct code_seg_t));
+	proc->code->refs = 1;
 	fscanf(file, "%u %u", &proc->priority, &proc->code->size);
 	proc->code->text = (struct inst_t*)malloc(
 		sizeof(struct inst_t) * proc->code->size
@@ -64,11 +99,13 @@ struct pcb_t * load(const char * path) {
 		case CALC:
 			break;
 		case ALLOC:
-			fscanf(
-				file,
-				"%u %u\n",
-				&proc->code->text[i].arg_0,
-				&proc->code->text[i].arg_1
+			/* alloc size reg [vmaid], on the heap by default */
+			proc->code->text[i].arg_2 = 0;
+			fgets(buf, sizeof(buf), file);
+			sscanf(buf, "%u %u %u",
+			           &proc->code->text[i].arg_0,
+			           &proc->code->text[i].arg_1,
+			           &proc->code->text[i].arg_2
 			);
 			break;
 		case FREE:
@@ -76,6 +113,8 @@ struct pcb_t * load(const char * path) {
 			break;
 		case READ:
 		case WRITE:
+		case READW:
+		case WRITEW:
 			fscanf(
 				file,
 				"%u %u %u\n",
@@ -84,6 +123,29 @@ struct pcb_t * load(const char * path) {
 				&proc->code->text[i].arg_2
 			);
 			break;	
+		case MEMSET:
+			/* memset value reg offset size */
+			fscanf(
+				file,
+				"%u %u %u %u\n",
+				&proc->code->text[i].arg_0,
+				&proc->code->text[i].arg_1,
+				&proc->code->text[i].arg_2,
+				&proc->code->text[i].arg_3
+			);
+			break;
+		case MEMCPY:
+			/* memcpy dstreg dstoffset srcreg srcoffset size */
+			fscanf(
+				file,
+				"%u %u %u %u %u\n",
+				&proc->code->text[i].arg_0,
+				&proc->code->text[i].arg_1,
+				&proc->code->text[i].arg_2,
+				&proc->code->text[i].arg_3,
+				&proc->code->text[i].arg_4
+			);
+			break;
 		case SYSCALL:
 			fgets(buf, sizeof(buf), file);
 			sscanf(buf, "%d%d%d%d",
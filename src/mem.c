@@ -5,7 +5,7 @@
 #include <stdio.h>
 #include "common.h"
 
-static BYTE _ram[RAM_SIZE];
+static BYTE _ram[RAM_SIZE];	// Zero from the start, left untouched until used
 
 static struct {
     uint32_t proc;	// ID of process currently uses this page
@@ -17,7 +17,6 @@ static pthread_mutex_t mem_lock;
 
 void init_mem(void) {
     memset(_mem_stat, 0, sizeof(*_mem_stat) * NUM_PAGES);
-    memset(_ram, 0, sizeof(BYTE) * RAM_SIZE);
     pthread_mutex_init(&mem_lock, NULL);
 }
 
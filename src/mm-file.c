@@ -0,0 +1,163 @@
+// #ifdef MM_PAGING
+/*
+ * PAGING based Memory Management
+ * File backed mmap areas mm/mm-file.c
+ */
+
+/*
+ * The host files named by "mmapfile<N>" in config can be mapped by the
+ * mmap syscall. The pages of such an area start reserved: the first touch
+ * reads the page from the file into a frame, eviction writes it back only
+ * when dirty and returns the entry to reserved, so the next touch reads
+ * it again. Pages never go to swap and are not charged against the commit
+ * limit, the file is their backing store.
+ *
+ * The page at address a of the area is at offset a - vm_start in the
+ * file. Bytes past the end of the file read as zero and are not written
+ * back. Processes mapping the same file each get their own frames and
+ * only see the writes of the others once written back.
+ */
+
+#include "mm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+struct mmfile {
+  int fd;
+  long size;
+};
+
+static struct mmfile mmfiles[PAGING_MAX_MMFILE + 1];
+static pthread_mutex_t mmfile_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * mmfile_open - open a host file for mapping, created when missing
+ * @file : file id, from 1
+ * @path : host path
+ */
+int mmfile_open(int file, const char *path)
+{
+  int fd;
+
+  if (file < 1 || file > PAGING_MAX_MMFILE || mmfiles[file].fd > 0)
+    return -1;
+
+  if ((fd = open(path, O_RDWR | O_CREAT, 0600)) < 0)
+    return -1;
+
+  mmfiles[file].fd = fd;
+  mmfiles[file].size = lseek(fd, 0, SEEK_END);
+  return 0;
+}
+
+/*
+ * mmfile_size - size of an open file in bytes, -1 if not open
+ */
+long mmfile_size(int file)
+{
+  long size;
+
+  if (file < 1 || file > PAGING_MAX_MMFILE || mmfiles[file].fd <= 0)
+    return -1;
+
+  pthread_mutex_lock(&mmfile_lock);
+  size = mmfiles[file].size;
+  pthread_mutex_unlock(&mmfile_lock);
+
+  return size;
+}
+
+/*
+ * mmfile_extend - grow a file to at least size bytes, for a mapping
+ *                 longer than the file
+ */
+int mmfile_extend(int file, long size)
+{
+  int ret = 0;
+
+  if (mmfile_size(file) < 0)
+    return -1;
+
+  pthread_mutex_lock(&mmfile_lock);
+  if (mmfiles[file].size < size)
+  {
+    ret = ftruncate(mmfiles[file].fd, size);
+    if (ret == 0)
+      mmfiles[file].size = size;
+  }
+  pthread_mutex_unlock(&mmfile_lock);
+
+  return ret;
+}
+
+/*
+ * mmfile_close_all - close every open file
+ */
+void mmfile_close_all(void)
+{
+  int file;
+
+  for (file = 1; file <= PAGING_MAX_MMFILE; file++)
+  {
+    if (mmfiles[file].fd > 0)
+      close(mmfiles[file].fd);
+    mmfiles[file].fd = 0;
+  }
+}
+
+/*
+ * vm_file_readpage - fill a MEMRAM frame with a page of a mapped file
+ * @vma  : file backed area holding the page
+ * @pgn  : page number
+ * @mram : MEMRAM device
+ * @fpn  : frame number
+ */
+int vm_file_readpage(struct vm_area_struct *vma, int pgn,
+                     struct memphy_struct *mram, int fpn)
+{
+  BYTE buf[PAGING_PAGESZ];
+  long off = (long)pgn * PAGING_PAGESZ - vma->vm_start;
+  ssize_t n;
+
+  n = pread(mmfiles[vma->vm_file].fd, buf, PAGING_PAGESZ, off);
+  if (n < 0)
+    return -1;
+  memset(buf + n, 0, PAGING_PAGESZ - n);
+
+  MMSTAT_ADD(pgfilein, 1);
+  return MEMPHY_write_page(mram, fpn, buf);
+}
+
+/*
+ * vm_file_writepage - write a MEMRAM frame back to its page of a mapped
+ *                     file
+ * @vma  : file backed area holding the page
+ * @pgn  : page number
+ * @mram : MEMRAM device
+ * @fpn  : frame number
+ */
+int vm_file_writepage(struct vm_area_struct *vma, int pgn,
+                      struct memphy_struct *mram, int fpn)
+{
+  BYTE buf[PAGING_PAGESZ];
+  long off = (long)pgn * PAGING_PAGESZ - vma->vm_start;
+  long len = mmfile_size(vma->vm_file) - off;
+
+  if (len > PAGING_PAGESZ)
+    len = PAGING_PAGESZ;
+  if (len <= 0)
+    return 0;
+
+  if (MEMPHY_read_page(mram, fpn, buf) != 0 ||
+      pwrite(mmfiles[vma->vm_file].fd, buf, len, off) != len)
+    return -1;
+
+  MMSTAT_ADD(pgfileout, 1);
+  return 0;
+}
+
+// #endif
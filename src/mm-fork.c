@@ -0,0 +1,277 @@
+// #ifdef MM_PAGING
+/*
+ * PAGING based Memory Management
+ * Copy-on-write fork mm/mm-fork.c
+ */
+
+/*
+ * The child of a fork gets a copy of the areas, regions and page table of
+ * its parent but no copy of its memory: every anonymous page online in the
+ * parent maps the same frame in both, with one more reference on it (see
+ * MEMPHY_get_frame()), and every swapped page the same slot, with one
+ * more reference on it (swap_dup()). Both page table entries are marked
+ * PAGING_PTE_COW_MASK.
+ *
+ * The first write to such a page copies the frame, unless the other mm
+ * already let it go; a swapped one is copied when read back from MEMSWP.
+ * A shared frame never keeps a swap cache entry, so dropping it is only a
+ * matter of references. Eviction cannot free a frame another mm still
+ * maps: it writes it to a slot of the evicting mm only and goes on with
+ * the next victim, see __mm_evict_page().
+ *
+ * The pages of a mapped file are read again from the file by the child,
+ * the dirty ones are written back first. Shared memory stays shared, the
+ * child is attached to the segments of the parent.
+ */
+
+#include "mm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Give child the page of parent at pgn */
+static void vm_fork_page(struct pcb_t *parent, struct pcb_t *child,
+                         struct vm_area_struct *vma, int pgn)
+{
+  uint32_t *pte = &parent->mm->pgd[pgn];
+  struct mm_struct *mm = child->mm;
+  uint32_t swpent;
+  int fpn;
+
+  if (vma->vm_shm != NULL || vma->vm_file != 0)
+  {
+    if (vma->vm_file != 0 && PAGING_PAGE_ONLINE(*pte) &&
+        (*pte & PAGING_PTE_DIRTY_MASK) &&
+        vm_file_writepage(vma, pgn, parent->mram, PAGING_FPN(*pte)) == 0)
+      CLRBIT(*pte, PAGING_PTE_DIRTY_MASK);
+    pte_set_reserve(&mm->pgd[pgn]);
+    return;
+  }
+
+  if (PAGING_PAGE_RESERVED(*pte))
+  {
+    pte_set_reserve(&mm->pgd[pgn]);
+    return;
+  }
+
+  if (PAGING_PAGE_SWAPPED(*pte))
+    swap_dup(parent->mswp[PAGING_SWPTYP(*pte)], PAGING_SWP(*pte));
+  else
+  {
+    fpn = PAGING_FPN(*pte);
+
+    /* The copy in MEMSWP belongs to one mm, drop it */
+    if ((swpent = swap_cache_take(parent->mram, fpn)) != 0)
+    {
+      swap_free(parent->mswp[PAGING_SWPTYP(swpent)], PAGING_SWP(swpent));
+      SETBIT(*pte, PAGING_PTE_DIRTY_MASK);
+    }
+
+    MEMPHY_get_frame(parent->mram, fpn);
+    pgrepl_on_map(mm->pgrepl, pgn);
+    parent->mm->cow_shared++;
+    mm->cow_shared++;
+    MMSTAT_ADD(cowshare, 1);
+  }
+
+  SETBIT(*pte, PAGING_PTE_COW_MASK);
+  mm->pgd[pgn] = *pte;
+  /* The bits of a swapped entry belong to its offset */
+  if (!PAGING_PAGE_SWAPPED(*pte))
+    CLRBIT(mm->pgd[pgn], PAGING_PTE_ACCESSED_MASK | PAGING_PTE_RAHEAD_MASK);
+}
+
+/* Give child a copy of the area of parent, under the same id */
+static int vm_fork_area(struct pcb_t *child, struct vm_area_struct *pvma)
+{
+  struct mm_struct *mm = child->mm;
+  struct vm_area_struct *vma;
+  struct vm_rg_struct *rg;
+
+  if (pvma->vm_id >= VMA_STACK_ID + 1 &&
+      vm_area_add(mm, pvma->vm_start, pvma->vm_end, pvma->vm_flags) < 0)
+    return -1;
+
+  vma = get_vma_by_num(mm, pvma->vm_id);
+  vma->vm_start = pvma->vm_start;
+  vma->vm_end = pvma->vm_end;
+  vma->vm_file = pvma->vm_file;
+  vma->sbrk = pvma->sbrk;
+
+  for (rg = pvma->vm_freerg_list; rg != NULL; rg = rg->rg_next)
+    if (vm_freerg_insert(vma, rg->rg_start, rg->rg_end) != 0)
+      return -1;
+
+  if (pvma->vm_shm != NULL)
+  {
+    vma->vm_shm = pvma->vm_shm;
+    return shm_fork_map(child, vma);
+  }
+
+  return 0;
+}
+
+/*
+ * vm_fork_mm - set up the mm of a forked child, sharing the memory of its
+ *              parent copy-on-write
+ * @parent : forking process
+ * @child  : new process, its mm allocated
+ */
+int vm_fork_mm(struct pcb_t *parent, struct pcb_t *child)
+{
+  struct mm_struct *pmm = parent->mm, *mm = child->mm;
+  struct vm_area_struct *pvma;
+  int i, pgn, endpgn;
+
+  if (init_mm(mm, child) != 0)
+    return -1;
+
+  pthread_mutex_lock(&pmm->lock);
+
+  /* The child is charged for the pages of its parent */
+  if (__atomic_add_fetch(&vm_committed, pmm->committed, __ATOMIC_RELAXED) > vm_commit_limit &&
+      vm_commit_limit > 0)
+  {
+    __atomic_sub_fetch(&vm_committed, pmm->committed, __ATOMIC_RELAXED);
+    MMSTAT_ADD(commitfail, 1);
+    pthread_mutex_unlock(&pmm->lock);
+    return -1;
+  }
+  mm->committed = pmm->committed;
+
+  /* Areas keep their ids, the ones removed from parent are removed too */
+  for (i = 0; i < pmm->vma_nid; i++)
+  {
+    if ((pvma = pmm->vma_byid[i]) != NULL)
+    {
+      if (vm_fork_area(child, pvma) != 0)
+        break;
+    }
+    else if (vm_area_add(mm, 0, 0, VM_MMAP) < 0 || vm_area_del(mm, i) != 0)
+      break;
+  }
+  if (i < pmm->vma_nid)
+  {
+    pthread_mutex_unlock(&pmm->lock);
+    return -1;
+  }
+
+  if (pmm->symrg_cap > 0)
+  {
+    mm->symrgtbl = malloc(pmm->symrg_cap * sizeof(struct vm_symrg));
+    if (mm->symrgtbl == NULL)
+    {
+      pthread_mutex_unlock(&pmm->lock);
+      return -1;
+    }
+    memcpy(mm->symrgtbl, pmm->symrgtbl, pmm->symrg_cap * sizeof(struct vm_symrg));
+    mm->symrg_cap = pmm->symrg_cap;
+    mm->symrg_cnt = pmm->symrg_cnt;
+  }
+
+  /* A page goes with the area holding its first byte */
+  for (pvma = pmm->mmap; pvma != NULL; pvma = pvma->vm_next)
+  {
+    endpgn = DIV_ROUND_UP(pvma->vm_end, PAGING_PAGESZ);
+    for (pgn = DIV_ROUND_UP(pvma->vm_start, PAGING_PAGESZ);
+         pgn < endpgn && pgn < PAGING_MAX_PGN; pgn++)
+      if (pmm->pgd[pgn] != 0)
+        vm_fork_page(parent, child, pvma, pgn);
+  }
+
+  MMSTAT_ADD(nfork, 1);
+  pthread_mutex_unlock(&pmm->lock);
+
+  return 0;
+}
+
+/*
+ * vm_cow_fault - make an online copy-on-write page of caller writable,
+ *                with the mm lock held
+ * @caller : caller
+ * @pgn    : page number
+ * @fpn    : return the frame of the page, a copy when it was shared
+ */
+int vm_cow_fault(struct pcb_t *caller, int pgn, int *fpn)
+{
+  struct mm_struct *mm = caller->mm;
+  uint32_t *pte = &mm->pgd[pgn];
+  int oldfpn = PAGING_FPN(*pte), newfpn;
+  uint64_t t0 = memphy_clock_ns();
+
+  mm->cow_faults++;
+
+  /* No other mm maps the frame any more, and only mine can map it again */
+  if (MEMPHY_frame_refs(caller->mram, oldfpn) == 1)
+  {
+    CLRBIT(*pte, PAGING_PTE_COW_MASK);
+    MMSTAT_ADD(cowreuse, 1);
+    *fpn = oldfpn;
+    return 0;
+  }
+
+  /* Keep the page from being its own victim */
+  pgrepl_on_unmap(mm->pgrepl, pgn);
+  if (pg_alloc_frame(caller, &newfpn) != 0)
+  { /* Still mapped and shared, a victim again */
+    pgrepl_on_map(mm->pgrepl, pgn);
+    return -1;
+  }
+
+  __swap_cp_page(caller->mram, oldfpn, caller->mram, newfpn);
+  MEMPHY_put_freefp(caller->mram, oldfpn);
+
+  CLRBIT(*pte, PAGING_PTE_COW_MASK);
+  pte_set_fpn(pte, newfpn);
+  pgrepl_on_map(mm->pgrepl, pgn);
+
+  mm->cow_copies++;
+  MMSTAT_ADD(cowcopy, 1);
+  MMSTAT_ADD(faultns, memphy_clock_ns() - t0);
+
+  *fpn = newfpn;
+  return 0;
+}
+
+/*
+ * vm_cow_swapout - swap a page out of caller alone, its frame still
+ *                  mapped by another mm, with the mm lock held
+ * @caller : caller
+ * @pgn    : page number of a victim, out of the replacement state
+ */
+int vm_cow_swapout(struct pcb_t *caller, int pgn)
+{
+  uint32_t *pte = &caller->mm->pgd[pgn];
+  int fpn = PAGING_FPN(*pte);
+  int swptyp, swpoff;
+
+  if (swap_get_slot(caller->mram, &swptyp, &swpoff) != 0)
+    return -1;
+
+  swap_writepage(caller->mram, fpn, caller->mswp[swptyp], swpoff);
+  *pte = 0;
+  pte_set_swap(pte, swptyp, swpoff);
+  MEMPHY_put_freefp(caller->mram, fpn);
+
+  MMSTAT_ADD(cowdrop, 1);
+  return 0;
+}
+
+/*
+ * vm_fork_report - copy-on-write counters of a process, if it forked or
+ *                  was forked
+ * @proc : process
+ */
+void vm_fork_report(struct pcb_t *proc)
+{
+  struct mm_struct *mm = proc->mm;
+
+  if (mm->cow_shared == 0)
+    return;
+
+  printf("\tProcess %2d: %d frames shared by fork, %d COW faults, "
+         "%d frames copied, %d saved\n", proc->pid, mm->cow_shared,
+         mm->cow_faults, mm->cow_copies, mm->cow_shared - mm->cow_copies);
+}
+
+// #endif
@@ -0,0 +1,369 @@
+// #ifdef MM_PAGING
+/*
+ * PAGING based Memory Management
+ * Same-page merging mm/mm-ksm.c
+ */
+
+/*
+ * The merging thread runs next to the CPUs, once every ksm_sleep time
+ * slots, and looks at no more than ksm_pages anonymous pages per pass, so
+ * its share of a slot stays small. It goes through the registered
+ * processes one after another (see mm-kswapd.c), resuming where the last
+ * pass stopped, and takes their mm lock with pthread_mutex_trylock only.
+ *
+ * A page is hashed on its content. The stable table holds the merged
+ * frames, each with a reference of its own: a page equal to one of them
+ * is pointed at it and its frame freed. The unstable table holds the
+ * pages seen since the last full scan: a page equal to one of them turns
+ * that frame into a merged one first. Both pages are then marked
+ * PAGING_PTE_COW_MASK, the next pg_setval() copies the frame again, see
+ * vm_cow_fault().
+ *
+ * Only private frames are candidates: pages shared by fork or already
+ * merged, shared memory and mapped files are left out. A merged frame
+ * nobody maps any more is freed after the next full scan.
+ */
+
+#include "mm.h"
+#include "timer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define KSM_HASH_SIZE 1024
+
+/* Settings, from "ksm", "ksm_pages" and "ksm_sleep" in config */
+int ksm_enabled = MM_KSM;
+int ksm_pages = 64;
+int ksm_sleep = 4;
+
+struct ksm_node {
+  uint32_t hash;
+  int fpn;             /* stable: merged frame */
+  uint32_t pid;        /* unstable: page of a process */
+  int pgn;
+  struct ksm_node *next;
+};
+
+static struct ksm_node *ksm_stable[KSM_HASH_SIZE];
+static struct ksm_node *ksm_unstable[KSM_HASH_SIZE];
+static int ksm_nstable = 0;
+
+/* Where the next pass resumes */
+static int ksm_proc = 0;
+static int ksm_pgn = 0;
+
+static int ksm_stopped = 0;
+static pthread_mutex_t ksm_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* FNV-1a */
+static uint32_t ksm_hash(const BYTE *buf)
+{
+  uint32_t h = 2166136261u;
+  int i;
+
+  for (i = 0; i < PAGING_PAGESZ; i++)
+    h = (h ^ (uint8_t)buf[i]) * 16777619u;
+
+  return h;
+}
+
+static struct pcb_t *ksm_find_proc(struct pcb_t **procs, int nproc, uint32_t pid)
+{
+  int i;
+
+  for (i = 0; i < nproc; i++)
+    if (procs[i]->pid == pid)
+      return procs[i];
+
+  return NULL;
+}
+
+/* A private anonymous online page, the only one mapping its frame */
+static int ksm_candidate(struct pcb_t *proc, int pgn)
+{
+  uint32_t pte = proc->mm->pgd[pgn];
+  struct vm_area_struct *vma;
+
+  if (!PAGING_PAGE_ONLINE(pte) || (pte & PAGING_PTE_COW_MASK))
+    return 0;
+
+  vma = get_vma_by_addr(proc->mm, pgn * PAGING_PAGESZ);
+  if (vma == NULL || vma->vm_shm != NULL || vma->vm_file != 0)
+    return 0;
+
+  return MEMPHY_frame_refs(proc->mram, PAGING_FPN(pte)) == 1;
+}
+
+/* The first page from pgn on in an anonymous area of proc, PAGING_MAX_PGN
+ * if there is none, so that the scan steps over the gaps */
+static int ksm_next_pgn(struct pcb_t *proc, int pgn)
+{
+  struct mm_struct *mm = proc->mm;
+  struct vm_area_struct *vma;
+  int i, startpgn, next = PAGING_MAX_PGN;
+
+  for (i = 0; i < mm->vma_cnt; i++)
+  {
+    vma = mm->vma_byaddr[i];
+    if (vma->vm_shm != NULL || vma->vm_file != 0 ||
+        DIV_ROUND_UP(vma->vm_end, PAGING_PAGESZ) <= pgn)
+      continue;
+    startpgn = vma->vm_start / PAGING_PAGESZ;
+    if (startpgn <= pgn)
+      return pgn;
+    if (startpgn < next)
+      next = startpgn;
+  }
+
+  return next;
+}
+
+/* Point a page at a merged frame, the frame it had goes away */
+static void ksm_map(struct pcb_t *proc, int pgn, int kfpn)
+{
+  uint32_t *pte = &proc->mm->pgd[pgn];
+  int fpn = PAGING_FPN(*pte);
+  uint32_t swpent;
+
+  if ((swpent = swap_cache_take(proc->mram, fpn)) != 0)
+    swap_free(proc->mswp[PAGING_SWPTYP(swpent)], PAGING_SWP(swpent));
+
+  MEMPHY_get_frame(proc->mram, kfpn);
+  pte_set_fpn(pte, kfpn);
+  SETBIT(*pte, PAGING_PTE_COW_MASK | PAGING_PTE_DIRTY_MASK);
+  MEMPHY_put_freefp(proc->mram, fpn);
+
+  MMSTAT_ADD(ksmmerge, 1);
+}
+
+/* Turn the frame of a page into a merged one */
+static void ksm_stable_add(struct pcb_t *proc, int pgn, uint32_t hash)
+{
+  uint32_t *pte = &proc->mm->pgd[pgn];
+  int fpn = PAGING_FPN(*pte);
+  struct ksm_node *node = malloc(sizeof(struct ksm_node));
+  uint32_t swpent;
+
+  if (node == NULL)
+    return;
+
+  if ((swpent = swap_cache_take(proc->mram, fpn)) != 0)
+    swap_free(proc->mswp[PAGING_SWPTYP(swpent)], PAGING_SWP(swpent));
+  SETBIT(*pte, PAGING_PTE_COW_MASK | PAGING_PTE_DIRTY_MASK);
+  MEMPHY_get_frame(proc->mram, fpn);
+
+  node->hash = hash;
+  node->fpn = fpn;
+  node->next = ksm_stable[hash % KSM_HASH_SIZE];
+  ksm_stable[hash % KSM_HASH_SIZE] = node;
+  ksm_nstable++;
+}
+
+/* End of a full scan: forget the unstable pages, free the merged frames
+ * only the stable table holds */
+static void ksm_scan_done(struct memphy_struct *mram)
+{
+  struct ksm_node **pn, *node;
+  int b;
+
+  for (b = 0; b < KSM_HASH_SIZE; b++)
+  {
+    while ((node = ksm_unstable[b]) != NULL)
+    {
+      ksm_unstable[b] = node->next;
+      free(node);
+    }
+
+    for (pn = &ksm_stable[b]; (node = *pn) != NULL; )
+    {
+      if (MEMPHY_frame_refs(mram, node->fpn) > 1)
+      {
+        pn = &node->next;
+        continue;
+      }
+      *pn = node->next;
+      MEMPHY_put_freefp(mram, node->fpn);
+      free(node);
+      ksm_nstable--;
+    }
+  }
+}
+
+/*
+ * Look for a page to merge with the page of proc, with its mm lock held.
+ * Return 1 when merged.
+ */
+static int ksm_scan_page(struct pcb_t **procs, int nproc,
+                         struct pcb_t *proc, int pgn)
+{
+  BYTE buf[PAGING_PAGESZ], kbuf[PAGING_PAGESZ];
+  struct ksm_node *node, **pn;
+  struct pcb_t *other;
+  uint32_t hash;
+  int merged = 0;
+
+  if (MEMPHY_read_page(proc->mram, PAGING_FPN(proc->mm->pgd[pgn]), buf) != 0)
+    return 0;
+  hash = ksm_hash(buf);
+
+  for (node = ksm_stable[hash % KSM_HASH_SIZE]; node != NULL; node = node->next)
+  {
+    if (node->hash != hash ||
+        MEMPHY_read_page(proc->mram, node->fpn, kbuf) != 0 ||
+        memcmp(buf, kbuf, PAGING_PAGESZ) != 0)
+      continue;
+    ksm_map(proc, pgn, node->fpn);
+    return 1;
+  }
+
+  for (pn = &ksm_unstable[hash % KSM_HASH_SIZE]; (node = *pn) != NULL; pn = &node->next)
+  {
+    if (node->hash == hash)
+      break;
+  }
+
+  if (node == NULL)
+  {
+    if ((node = malloc(sizeof(struct ksm_node))) == NULL)
+      return 0;
+    node->hash = hash;
+    node->pid = proc->pid;
+    node->pgn = pgn;
+    node->next = ksm_unstable[hash % KSM_HASH_SIZE];
+    ksm_unstable[hash % KSM_HASH_SIZE] = node;
+    return 0;
+  }
+
+  /* The page seen earlier, if it is still there and still the same */
+  other = ksm_find_proc(procs, nproc, node->pid);
+  if (other != NULL && (other == proc || pthread_mutex_trylock(&other->mm->lock) == 0))
+  {
+    if ((other != proc || node->pgn != pgn) && ksm_candidate(other, node->pgn) &&
+        MEMPHY_read_page(other->mram, PAGING_FPN(other->mm->pgd[node->pgn]), kbuf) == 0 &&
+        memcmp(buf, kbuf, PAGING_PAGESZ) == 0)
+    {
+      ksm_stable_add(other, node->pgn, hash);
+      ksm_map(proc, pgn, PAGING_FPN(other->mm->pgd[node->pgn]));
+      merged = 1;
+    }
+    if (other != proc)
+      pthread_mutex_unlock(&other->mm->lock);
+  }
+
+  /* Either merged or stale, the current page takes the slot */
+  node->pid = proc->pid;
+  node->pgn = pgn;
+  if (merged)
+  {
+    *pn = node->next;
+    free(node);
+  }
+
+  return merged;
+}
+
+/*
+ * ksm_pass - scan up to ksm_pages candidate pages
+ * @mram : MEMRAM device
+ */
+static void ksm_pass(struct memphy_struct *mram)
+{
+  struct pcb_t **procs, *proc;
+  uint64_t t0 = memphy_clock_ns();
+  int nproc, nscan = 0, nmerge = 0;
+
+  nproc = reclaim_registry_get(&procs);
+
+  /* One full scan at most, a busy process waits for the next one */
+  while (nscan < ksm_pages)
+  {
+    if (ksm_proc >= nproc)
+    {
+      ksm_proc = 0;
+      ksm_pgn = 0;
+      ksm_scan_done(mram);
+      MMSTAT_ADD(ksmfullscan, 1);
+      break;
+    }
+    proc = procs[ksm_proc];
+
+    if (pthread_mutex_trylock(&proc->mm->lock) != 0)
+    {
+      ksm_proc++;
+      ksm_pgn = 0;
+      continue;
+    }
+
+    for (; nscan < ksm_pages &&
+           (ksm_pgn = ksm_next_pgn(proc, ksm_pgn)) < PAGING_MAX_PGN; ksm_pgn++)
+    {
+      if (!ksm_candidate(proc, ksm_pgn))
+        continue;
+      nscan++;
+      nmerge += ksm_scan_page(procs, nproc, proc, ksm_pgn);
+    }
+    pthread_mutex_unlock(&proc->mm->lock);
+
+    if (ksm_pgn >= PAGING_MAX_PGN)
+    {
+      ksm_proc++;
+      ksm_pgn = 0;
+    }
+  }
+
+  reclaim_registry_put();
+
+  MMSTAT_ADD(ksmscan, nscan);
+  MMSTAT_ADD(ksmpass, 1);
+  MMSTAT_ADD(ksmns, memphy_clock_ns() - t0);
+
+  if (nscan > 0)
+      printf("\tKSM: %d pages scanned, %d merged, %d merged frames, %.1f us\n",
+           nscan, nmerge, ksm_nstable, (memphy_clock_ns() - t0) / 1e3);
+}
+
+/*
+ * ksm_routine - merging thread, driven by the timer
+ * @args : struct kswapd_args
+ */
+void *ksm_routine(void *args)
+{
+  struct timer_id_t *timer_id = ((struct kswapd_args *)args)->timer_id;
+  struct memphy_struct *mram = ((struct kswapd_args *)args)->mram;
+  int slot = 0, stop = 0;
+
+  while (!stop)
+  {
+    pthread_mutex_lock(&ksm_lock);
+    stop = ksm_stopped;
+    pthread_mutex_unlock(&ksm_lock);
+
+    if (!stop && ++slot >= ksm_sleep)
+    {
+      ksm_pass(mram);
+      slot = 0;
+    }
+
+    next_slot(timer_id);
+  }
+
+  /* Every process is gone, so are the merged frames */
+  ksm_scan_done(mram);
+
+  detach_event(timer_id);
+  pthread_exit(NULL);
+}
+
+/*
+ * ksm_stop - let the merging thread finish at its next time slot
+ */
+void ksm_stop(void)
+{
+  pthread_mutex_lock(&ksm_lock);
+  ksm_stopped = 1;
+  pthread_mutex_unlock(&ksm_lock);
+}
+
+// #endif
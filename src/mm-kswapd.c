@@ -0,0 +1,296 @@
+// #ifdef MM_PAGING
+/*
+ * PAGING based Memory Management
+ * Background page reclaim mm/mm-kswapd.c
+ */
+
+/*
+ * The reclaim thread runs once per time slot next to the CPUs. When the
+ * free frames of MEMRAM drop below the low watermark it evicts pages of
+ * the loaded processes, one process after another, until the high
+ * watermark is reached, so that faults and allocations seldom have to
+ * evict inline.
+ *
+ * The same registry of processes serves inline reclaim when the faulting
+ * process has nothing left to evict, and the OOM killer when no process
+ * can be swapped out any more.
+ *
+ * Pages of another process are only taken when its mm lock is free at
+ * once (pthread_mutex_trylock), with the registry lock held so that the
+ * process cannot go away meanwhile.
+ */
+
+#include "mm.h"
+#include "timer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+/* Settings, from "kswapd", "wmark_low" and "wmark_high" in config.
+ * A watermark below 0 is derived from the MEMRAM size. */
+int kswapd_enabled = MM_KSWAPD;
+int kswapd_wmark_low = -1;
+int kswapd_wmark_high = -1;
+
+static struct pcb_t **kswapd_procs = NULL;
+static int kswapd_nproc = 0;
+static int kswapd_cap = 0;
+static int kswapd_stopped = 0;
+static pthread_mutex_t kswapd_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * kswapd_evict - evict a page of a registered process if its mm is not
+ *                busy, with the registry lock held
+ */
+static int kswapd_evict(struct pcb_t *proc, int *fpn)
+{
+  int ret;
+
+  if (pthread_mutex_trylock(&proc->mm->lock) != 0)
+    return -1;
+  ret = __mm_evict_page(proc, fpn);
+  pthread_mutex_unlock(&proc->mm->lock);
+
+  return ret;
+}
+
+/*
+ * kswapd_register - make the pages of a process reclaimable
+ */
+int kswapd_register(struct pcb_t *proc)
+{
+  pthread_mutex_lock(&kswapd_lock);
+  if (kswapd_nproc == kswapd_cap)
+  {
+    int ncap = kswapd_cap ? kswapd_cap * 2 : 8;
+    struct pcb_t **nprocs = realloc(kswapd_procs, ncap * sizeof(struct pcb_t *));
+
+    if (nprocs == NULL)
+    {
+      pthread_mutex_unlock(&kswapd_lock);
+      return -1;
+    }
+    kswapd_procs = nprocs;
+    kswapd_cap = ncap;
+  }
+  kswapd_procs[kswapd_nproc++] = proc;
+  pthread_mutex_unlock(&kswapd_lock);
+
+  return 0;
+}
+
+/*
+ * kswapd_unregister - forget a process, before its pcb goes away
+ */
+int kswapd_unregister(struct pcb_t *proc)
+{
+  int i;
+
+  pthread_mutex_lock(&kswapd_lock);
+  for (i = 0; i < kswapd_nproc; i++)
+  {
+    if (kswapd_procs[i] == proc)
+    {
+      kswapd_procs[i] = kswapd_procs[--kswapd_nproc];
+      break;
+    }
+  }
+  pthread_mutex_unlock(&kswapd_lock);
+
+  return 0;
+}
+
+/*
+ * kswapd_reclaim - evict pages until the high watermark, round-robin
+ *                  over the processes, with the registry lock held
+ * @mram : MEMRAM device
+ * @high : free frames to reach
+ */
+static int kswapd_reclaim(struct memphy_struct *mram, int high)
+{
+  static int rr = 0;
+  int fails = 0, nr = 0, fpn;
+
+  while (MEMPHY_free_frames(mram) < high && kswapd_nproc > 0 &&
+         fails < kswapd_nproc)
+  {
+    struct pcb_t *proc = kswapd_procs[rr++ % kswapd_nproc];
+
+    if (kswapd_evict(proc, &fpn) != 0)
+    {
+      fails++;
+      continue;
+    }
+
+    MEMPHY_put_freefp(mram, fpn);
+    fails = 0;
+    nr++;
+  }
+
+  return nr;
+}
+
+/*
+ * reclaim_global_page - evict a page of another process than caller,
+ *                       with the mm lock of caller held
+ * @caller : process in need of a frame
+ * @fpn    : returned frame
+ */
+int reclaim_global_page(struct pcb_t *caller, int *fpn)
+{
+  static int rr = 0;
+  int i;
+
+  pthread_mutex_lock(&kswapd_lock);
+  for (i = 0; i < kswapd_nproc; i++)
+  {
+    struct pcb_t *proc = kswapd_procs[rr++ % kswapd_nproc];
+
+    if (proc == caller || kswapd_evict(proc, fpn) != 0)
+      continue;
+
+    pthread_mutex_unlock(&kswapd_lock);
+    MMSTAT_ADD(pgsteal_global, 1);
+    return 0;
+  }
+  pthread_mutex_unlock(&kswapd_lock);
+
+  return -1;
+}
+
+/*
+ * oom_npages - pages a process holds in MEMRAM or MEMSWP, found by walking
+ *              its vm areas, with its mm lock held
+ */
+static int oom_npages(struct mm_struct *mm)
+{
+  struct vm_area_struct *vma;
+  int pgn, endpgn, npg = 0;
+
+  for (vma = mm->mmap; vma != NULL; vma = vma->vm_next)
+  {
+    endpgn = DIV_ROUND_UP(vma->vm_end, PAGING_PAGESZ);
+    for (pgn = vma->vm_start / PAGING_PAGESZ;
+         pgn < endpgn && pgn < PAGING_MAX_PGN; pgn++)
+      npg += PAGING_PAGE_PRESENT(mm->pgd[pgn]) ? 1 : 0;
+  }
+
+  return npg;
+}
+
+/*
+ * oom_kill - free the memory of the process holding the most pages,
+ *            with the mm lock of caller held
+ * @caller : process in need of memory, a candidate as well
+ *
+ * Processes whose mm is busy are left out. The victim stops at its next
+ * instruction, see cpu_routine().
+ */
+int oom_kill(struct pcb_t *caller)
+{
+  struct pcb_t *victim = NULL;
+  int i, npg, maxpg = 0;
+
+  pthread_mutex_lock(&kswapd_lock);
+  for (i = 0; i < kswapd_nproc; i++)
+  {
+    struct pcb_t *proc = kswapd_procs[i];
+
+    if (proc != caller && pthread_mutex_trylock(&proc->mm->lock) != 0)
+      continue;
+    npg = oom_npages(proc->mm);
+    if (proc != caller)
+      pthread_mutex_unlock(&proc->mm->lock);
+
+    /* On a tie, spare caller */
+    if (npg > maxpg || (npg == maxpg && npg > 0 && victim == caller))
+    {
+      victim = proc;
+      maxpg = npg;
+    }
+  }
+
+  if (victim == NULL ||
+      (victim != caller && pthread_mutex_trylock(&victim->mm->lock) != 0))
+  {
+    pthread_mutex_unlock(&kswapd_lock);
+    return -1;
+  }
+
+  printf("OOM: killed process %d holding %d pages\n", victim->pid, maxpg);
+  victim->oom_killed = 1;
+  __free_pcb_memph(victim);
+  MMSTAT_ADD(oomkill, 1);
+
+  if (victim != caller)
+    pthread_mutex_unlock(&victim->mm->lock);
+  pthread_mutex_unlock(&kswapd_lock);
+
+  return 0;
+}
+
+/*
+ * reclaim_registry_get - lock the registry and return the processes in it,
+ *                        until reclaim_registry_put()
+ * @procs : returned array of processes
+ */
+int reclaim_registry_get(struct pcb_t ***procs)
+{
+  pthread_mutex_lock(&kswapd_lock);
+  *procs = kswapd_procs;
+
+  return kswapd_nproc;
+}
+
+void reclaim_registry_put(void)
+{
+  pthread_mutex_unlock(&kswapd_lock);
+}
+
+/*
+ * kswapd_routine - reclaim thread, driven by the timer
+ * @args : struct kswapd_args
+ */
+void *kswapd_routine(void *args)
+{
+  struct timer_id_t *timer_id = ((struct kswapd_args *)args)->timer_id;
+  struct memphy_struct *mram = ((struct kswapd_args *)args)->mram;
+  int numfp = mram->maxsz / PAGING_PAGESZ;
+  int low = kswapd_wmark_low, high = kswapd_wmark_high;
+  int nr, stop = 0;
+
+  if (low < 0)
+    low = (numfp / 32 > 1) ? numfp / 32 : 1;
+  if (high <= low)
+    high = (numfp / 16 > low) ? numfp / 16 : low + 1;
+
+  while (!stop)
+  {
+    pthread_mutex_lock(&kswapd_lock);
+    stop = kswapd_stopped;
+    if (!stop && MEMPHY_free_frames(mram) < low)
+    {
+      nr = kswapd_reclaim(mram, high);
+      MMSTAT_ADD(kswapd_wake, 1);
+      MMSTAT_ADD(pgsteal_bg, nr);
+    }
+    pthread_mutex_unlock(&kswapd_lock);
+
+    next_slot(timer_id);
+  }
+
+  detach_event(timer_id);
+  pthread_exit(NULL);
+}
+
+/*
+ * kswapd_stop - let the reclaim thread finish at its next time slot
+ */
+void kswapd_stop(void)
+{
+  pthread_mutex_lock(&kswapd_lock);
+  kswapd_stopped = 1;
+  pthread_mutex_unlock(&kswapd_lock);
+}
+
+// #endif
@@ -8,23 +8,140 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+uint64_t memphy_clock_ns(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Content dump after each access under IODUMP, from "memdump" in config */
+int memphy_dump_mode = -1;
+
+/*
+ *  memphy_mark - record a write to a frame for the next MEMPHY_dump(), a
+ *                lock taken only the first time since that dump
+ *  @mp: memphy struct
+ *  @fpn: frame number, written before the call, the device lock not held
+ */
+static void memphy_mark(struct memphy_struct *mp, int fpn)
+{
+   uint32_t bit = BIT(fpn % 32);
+   uint32_t *word;
+
+   if (mp->dirtymap == NULL)
+      return;
+
+   word = &mp->dirtymap[fpn / 32];
+   if (__atomic_load_n(word, __ATOMIC_ACQUIRE) & bit)
+      return;
+
+   pthread_mutex_lock(&mp->dumplock);
+   if (!(*word & bit))
+   {
+      __atomic_or_fetch(word, bit, __ATOMIC_RELEASE);
+      mp->usedmap[fpn / 32] |= bit;
+      mp->dirtylist[mp->ndirty++] = fpn;
+   }
+   pthread_mutex_unlock(&mp->dumplock);
+}
+
+/*
+ *  Byte access to the storage, through the file for MEMPHY_FILE and
+ *  the whole page for MEMPHY_ZRAM
+ */
+static BYTE memphy_getb(struct memphy_struct *mp, int addr)
+{
+   BYTE value = 0;
+   BYTE page[PAGING_PAGESZ];
+
+   if (mp->storage != NULL)
+      return mp->storage[addr];
+
+   if (mp->kind == MEMPHY_ZRAM)
+   {
+      zpool_load(mp->zpool, addr / PAGING_PAGESZ, page);
+      return page[addr % PAGING_PAGESZ];
+   }
+
+   if (pread(mp->fd, &value, 1, addr) != 1)
+      return 0;
+   return value;
+}
+
+static void memphy_putb(struct memphy_struct *mp, int addr, BYTE value)
+{
+   BYTE page[PAGING_PAGESZ];
+
+   if (mp->storage != NULL)
+      mp->storage[addr] = value;
+   else if (mp->kind == MEMPHY_ZRAM)
+   {
+      zpool_load(mp->zpool, addr / PAGING_PAGESZ, page);
+      page[addr % PAGING_PAGESZ] = value;
+      zpool_store(mp->zpool, addr / PAGING_PAGESZ, page);
+   }
+   else if (pwrite(mp->fd, &value, 1, addr) != 1)
+      printf("MEMPHY write at %d failed\n", addr);
+}
+
+/* Time slots the accesses of this thread spent on sequential devices,
+ * not yet charged, see cpu_routine() */
+__thread double memphy_iowait = 0;
 
 /*
  *  MEMPHY_mv_csr - move MEMPHY cursor
  *  @mp: memphy struct
  *  @offset: offset
+ *
+ *  With the device lock held. The seek costs seeklat time slots per MiB
+ *  travelled, whichever the direction.
  */
 int MEMPHY_mv_csr(struct memphy_struct *mp, int offset)
 {
-   int numstep = 0;
+   int dist;
+   double lat;
+
+   if (offset < 0 || offset > mp->maxsz)
+      return -1;
 
-   mp->cursor = 0;
-   while (numstep < offset && numstep < mp->maxsz)
+   dist = (offset > mp->cursor) ? offset - mp->cursor : mp->cursor - offset;
+   if (dist > 0)
    {
-      /* Traverse sequentially */
-      mp->cursor = (mp->cursor + 1) % mp->maxsz;
-      numstep++;
+      lat = mp->seeklat * dist / (1 << 20);
+      mp->nseek++;
+      mp->seekdist += dist;
+      mp->iolat += lat;
+      memphy_iowait += lat;
    }
+   mp->cursor = offset;
+
+   return 0;
+}
+
+/*
+ *  memphy_seq_access - seek to addr and move the cursor over len bytes,
+ *                      with the device lock held
+ *  @mp: memphy struct
+ *  @addr: address
+ *  @len: bytes transferred, xferlat time slots per page
+ */
+static int memphy_seq_access(struct memphy_struct *mp, int addr, int len)
+{
+   double lat = mp->xferlat * len / PAGING_PAGESZ;
+
+   if (addr + len > mp->maxsz || MEMPHY_mv_csr(mp, addr) != 0)
+      return -1;
+
+   mp->cursor = addr + len;
+   mp->iolat += lat;
+   memphy_iowait += lat;
 
    return 0;
 }
@@ -40,11 +157,17 @@ int MEMPHY_seq_read(struct memphy_struct *mp, int addr, BYTE *value)
    if (mp == NULL)
       return -1;
 
-   if (!mp->rdmflg)
+   if (mp->rdmflg)
       return -1; /* Not compatible mode for sequential read */
 
-   MEMPHY_mv_csr(mp, addr);
-   *value = (BYTE)mp->storage[addr];
+   pthread_mutex_lock(&mp->lock);
+   if (memphy_seq_access(mp, addr, 1) != 0)
+   {
+      pthread_mutex_unlock(&mp->lock);
+      return -1;
+   }
+   *value = memphy_getb(mp, addr);
+   pthread_mutex_unlock(&mp->lock);
 
    return 0;
 }
@@ -61,7 +184,7 @@ int MEMPHY_read(struct memphy_struct *mp, int addr, BYTE *value)
       return -1;
 
    if (mp->rdmflg)
-      *value = mp->storage[addr];
+      *value = memphy_getb(mp, addr);
    else /* Sequential access device */
       return MEMPHY_seq_read(mp, addr, value);
 
@@ -80,11 +203,18 @@ int MEMPHY_seq_write(struct memphy_struct *mp, int addr, BYTE value)
    if (mp == NULL)
       return -1;
 
-   if (!mp->rdmflg)
-      return -1; /* Not compatible mode for sequential read */
+   if (mp->rdmflg)
+      return -1; /* Not compatible mode for sequential write */
 
-   MEMPHY_mv_csr(mp, addr);
-   mp->storage[addr] = value;
+   pthread_mutex_lock(&mp->lock);
+   if (memphy_seq_access(mp, addr, 1) != 0)
+   {
+      pthread_mutex_unlock(&mp->lock);
+      return -1;
+   }
+   memphy_putb(mp, addr, value);
+   pthread_mutex_unlock(&mp->lock);
+   memphy_mark(mp, addr / PAGING_PAGESZ);
 
    return 0;
 }
@@ -101,13 +231,127 @@ int MEMPHY_write(struct memphy_struct *mp, int addr, BYTE data)
       return -1;
 
    if (mp->rdmflg)
-      mp->storage[addr] = data;
+   {
+      memphy_putb(mp, addr, data);
+      memphy_mark(mp, addr / PAGING_PAGESZ);
+   }
    else /* Sequential access device */
       return MEMPHY_seq_write(mp, addr, data);
 
    return 0;
 }
 
+/*
+ *  MEMPHY_read_range - read bytes of one frame
+ *  @mp: memphy struct
+ *  @addr: address
+ *  @buf: returned bytes
+ *  @len: bytes to read, up to the end of the frame of addr
+ */
+int MEMPHY_read_range(struct memphy_struct *mp, int addr, BYTE *buf, int len)
+{
+   BYTE page[PAGING_PAGESZ];
+
+   if (mp == NULL || addr < 0 || len < 0 ||
+       addr % PAGING_PAGESZ + len > PAGING_PAGESZ || addr + len > mp->maxsz)
+      return -1;
+
+   if (!mp->rdmflg) /* Sequential device seeks once for the range */
+   {
+      pthread_mutex_lock(&mp->lock);
+      if (memphy_seq_access(mp, addr, len) != 0)
+      {
+         pthread_mutex_unlock(&mp->lock);
+         return -1;
+      }
+      pthread_mutex_unlock(&mp->lock);
+   }
+
+   if (mp->storage != NULL)
+      memcpy(buf, mp->storage + addr, len);
+   else if (mp->kind == MEMPHY_ZRAM)
+   {
+      if (len == PAGING_PAGESZ)
+         return zpool_load(mp->zpool, addr / PAGING_PAGESZ, buf);
+      if (zpool_load(mp->zpool, addr / PAGING_PAGESZ, page) != 0)
+         return -1;
+      memcpy(buf, page + addr % PAGING_PAGESZ, len);
+   }
+   else if (pread(mp->fd, buf, len, addr) != len)
+      return -1;
+
+   return 0;
+}
+
+/*
+ *  MEMPHY_write_range - write bytes of one frame
+ *  @mp: memphy struct
+ *  @addr: address
+ *  @buf: bytes to write
+ *  @len: bytes to write, up to the end of the frame of addr
+ */
+int MEMPHY_write_range(struct memphy_struct *mp, int addr, const BYTE *buf, int len)
+{
+   BYTE page[PAGING_PAGESZ];
+
+   if (mp == NULL || addr < 0 || len < 0 ||
+       addr % PAGING_PAGESZ + len > PAGING_PAGESZ || addr + len > mp->maxsz)
+      return -1;
+
+   if (!mp->rdmflg) /* Sequential device seeks once for the range */
+   {
+      pthread_mutex_lock(&mp->lock);
+      if (memphy_seq_access(mp, addr, len) != 0)
+      {
+         pthread_mutex_unlock(&mp->lock);
+         return -1;
+      }
+      pthread_mutex_unlock(&mp->lock);
+   }
+
+   if (mp->storage != NULL)
+      memcpy(mp->storage + addr, buf, len);
+   else if (mp->kind == MEMPHY_ZRAM)
+   {
+      if (len < PAGING_PAGESZ)
+      {
+         if (zpool_load(mp->zpool, addr / PAGING_PAGESZ, page) != 0)
+            return -1;
+         memcpy(page + addr % PAGING_PAGESZ, buf, len);
+         buf = page;
+      }
+      if (zpool_store(mp->zpool, addr / PAGING_PAGESZ, buf) != 0)
+         return -1;
+   }
+   else if (pwrite(mp->fd, buf, len, addr) != len)
+      return -1;
+
+   memphy_mark(mp, addr / PAGING_PAGESZ);
+   return 0;
+}
+
+/*
+ *  MEMPHY_read_page - read a whole frame
+ *  @mp: memphy struct
+ *  @fpn: frame number
+ *  @buf: PAGING_PAGESZ bytes
+ */
+int MEMPHY_read_page(struct memphy_struct *mp, int fpn, BYTE *buf)
+{
+   return MEMPHY_read_range(mp, fpn * PAGING_PAGESZ, buf, PAGING_PAGESZ);
+}
+
+/*
+ *  MEMPHY_write_page - write a whole frame
+ *  @mp: memphy struct
+ *  @fpn: frame number
+ *  @buf: PAGING_PAGESZ bytes
+ */
+int MEMPHY_write_page(struct memphy_struct *mp, int fpn, const BYTE *buf)
+{
+   return MEMPHY_write_range(mp, fpn * PAGING_PAGESZ, buf, PAGING_PAGESZ);
+}
+
 /*
  *  MEMPHY_format-format MEMPHY device
  *  @mp: memphy struct
@@ -125,7 +369,9 @@ int MEMPHY_format(struct memphy_struct *mp, int pagesz)
    /* Init head of free framephy list */
    fst = malloc(sizeof(struct framephy_struct));
    fst->fpn = iter;
+   fst->fp_next = NULL;
    mp->free_fp_list = fst;
+   mp->nfreefp = numfp;
 
    /* We have list with first element, fill in the rest num-1 element member*/
    for (iter = 1; iter < numfp; iter++)
@@ -142,13 +388,22 @@ int MEMPHY_format(struct memphy_struct *mp, int pagesz)
 
 int MEMPHY_get_freefp(struct memphy_struct *mp, int *retfpn)
 {
-   struct framephy_struct *fp = mp->free_fp_list;
+   struct framephy_struct *fp;
 
+   pthread_mutex_lock(&mp->lock);
+   fp = mp->free_fp_list;
    if (fp == NULL)
+   {
+      pthread_mutex_unlock(&mp->lock);
       return -1;
+   }
 
    *retfpn = fp->fpn;
    mp->free_fp_list = fp->fp_next;
+   mp->nfreefp--;
+   if (mp->frmref != NULL)
+      mp->frmref[fp->fpn] = 1;
+   pthread_mutex_unlock(&mp->lock);
 
    /* MEMPHY is iteratively used up until its exhausted
     * No garbage collector acting then it not been released
@@ -158,24 +413,390 @@ int MEMPHY_get_freefp(struct memphy_struct *mp, int *retfpn)
    return 0;
 }
 
+/*
+ *  MEMPHY_dump_select - set the dump mode by name: off, diff or full
+ */
+int MEMPHY_dump_select(const char *name)
+{
+   if (!strcmp(name, "off"))
+      memphy_dump_mode = MEMPHY_DUMP_OFF;
+   else if (!strcmp(name, "diff"))
+      memphy_dump_mode = MEMPHY_DUMP_DIFF;
+   else if (!strcmp(name, "full"))
+      memphy_dump_mode = MEMPHY_DUMP_FULL;
+   else
+      return -1;
+
+   return 0;
+}
+
+static int memphy_cmp_fpn(const void *a, const void *b)
+{
+   return *(const int *)a - *(const int *)b;
+}
+
+/* Print the bytes of a frame that differ from its last dump, as runs of
+ * at most 8 bytes */
+static void memphy_dump_diff(int fpn, const BYTE *old, const BYTE *cur)
+{
+   int off = 0, end, i;
+
+   while (off < PAGING_PAGESZ)
+   {
+      if (old[off] == cur[off])
+      {
+         off++;
+         continue;
+      }
+      for (end = off + 1; end < PAGING_PAGESZ && end - off < 8 &&
+                          old[end] != cur[end]; end++)
+         ;
+
+      printf("\tframe %4d +%03d:", fpn, off);
+      for (i = off; i < end; i++)
+         printf(" %02x", (uint8_t)old[i]);
+      printf(" ->");
+      for (i = off; i < end; i++)
+         printf(" %02x", (uint8_t)cur[i]);
+      printf("\n");
+      off = end;
+   }
+}
+
+/* Print the 16 byte rows of a frame holding anything but zeros */
+static void memphy_dump_frame(int fpn, const BYTE *cur)
+{
+   static const BYTE zeros[16];
+   int off, i;
+
+   for (off = 0; off < PAGING_PAGESZ; off += 16)
+   {
+      if (!memcmp(cur + off, zeros, 16))
+         continue;
+      printf("\tframe %4d +%03d:", fpn, off);
+      for (i = off; i < off + 16; i++)
+         printf(" %02x", (uint8_t)cur[i]);
+      printf("\n");
+   }
+}
+
+/*
+ *  Bring the snapshot of a frame to its content, the frame leaves the
+ *  used ones once it holds zeros only. Return 1 when it did not change.
+ */
+static int memphy_dump_sync(struct memphy_struct *mp, int fpn, BYTE *cur)
+{
+   static const BYTE zeros[PAGING_PAGESZ];
+   BYTE **shadow = &mp->shadow[fpn];
+   const BYTE *old = (*shadow != NULL) ? *shadow : zeros;
+   int same = !memcmp(old, cur, PAGING_PAGESZ);
+
+   if (memphy_dump_mode != MEMPHY_DUMP_FULL && !same)
+      memphy_dump_diff(fpn, old, cur);
+
+   if (!memcmp(cur, zeros, PAGING_PAGESZ))
+   {
+      free(*shadow);
+      *shadow = NULL;
+      CLRBIT(mp->usedmap[fpn / 32], BIT(fpn % 32));
+   }
+   else if (!same)
+   {
+      if (*shadow == NULL)
+         *shadow = malloc(PAGING_PAGESZ);
+      if (*shadow != NULL)
+         memcpy(*shadow, cur, PAGING_PAGESZ);
+   }
+
+   return same;
+}
+
+/*
+ *  MEMPHY_dump - print what the frames written since the last dump now
+ *                hold, as a diff, or every frame in use in full mode
+ *  @mp: memphy struct
+ *
+ *  Only the frames written since the last dump are compared with their
+ *  snapshot, the full mode walks the bitmap of the frames holding
+ *  non-zero bytes. Frames are taken in order.
+ */
 int MEMPHY_dump(struct memphy_struct *mp)
 {
-  /*TODO dump memphy contnt mp->storage
-   *     for tracing the memory content
-   */
+   BYTE cur[PAGING_PAGESZ];
+   uint64_t t0 = memphy_clock_ns();
+   int numfp, nvisit, nchg = 0, i, w, fpn;
+
+   if (memphy_dump_mode < 0)
+      MEMPHY_dump_select(MM_MEMDUMP);
+   if (mp == NULL || mp->dirtymap == NULL || memphy_dump_mode == MEMPHY_DUMP_OFF)
+      return 0;
+
+   numfp = mp->maxsz / PAGING_PAGESZ;
+   pthread_mutex_lock(&mp->dumplock);
+   if (mp->shadow == NULL &&
+       (mp->shadow = calloc(numfp, sizeof(BYTE *))) == NULL)
+   {
+      pthread_mutex_unlock(&mp->dumplock);
+      return -1;
+   }
+
+   /* A write from now on marks its frame again */
+   nvisit = mp->ndirty;
+   for (i = 0; i < nvisit; i++)
+      __atomic_and_fetch(&mp->dirtymap[mp->dirtylist[i] / 32],
+                         ~BIT(mp->dirtylist[i] % 32), __ATOMIC_ACQ_REL);
+   mp->ndirty = 0;
+
+   if (memphy_dump_mode == MEMPHY_DUMP_FULL)
+   {
+      for (i = 0; i < nvisit; i++)
+         if (MEMPHY_read_page(mp, mp->dirtylist[i], cur) == 0)
+            nchg += !memphy_dump_sync(mp, mp->dirtylist[i], cur);
+
+      printf("MEMPHY snapshot, %d frames changed:\n", nchg);
+      for (w = 0; w < DIV_ROUND_UP(numfp, 32); w++)
+      {
+         uint32_t bits = mp->usedmap[w];
+
+         while (bits != 0)
+         {
+            fpn = w * 32 + __builtin_ctz(bits);
+            bits &= bits - 1;
+            if (MEMPHY_read_page(mp, fpn, cur) == 0)
+               memphy_dump_frame(fpn, cur);
+            nvisit++;
+         }
+      }
+   }
+   else
+   {
+      qsort(mp->dirtylist, nvisit, sizeof(int), memphy_cmp_fpn);
+      for (i = 0; i < nvisit; i++)
+         if (MEMPHY_read_page(mp, mp->dirtylist[i], cur) == 0)
+            nchg += !memphy_dump_sync(mp, mp->dirtylist[i], cur);
+   }
+   pthread_mutex_unlock(&mp->dumplock);
+
+   MMSTAT_ADD(memdump, 1);
+   MMSTAT_ADD(memdumpfrm, nvisit);
+   MMSTAT_ADD(memdumpns, memphy_clock_ns() - t0);
+
+   return 0;
+}
+
+/*
+ *  MEMPHY_zero_frame - fill a frame with zeros
+ *  @mp: memphy struct
+ *  @fpn: frame number
+ */
+int MEMPHY_zero_frame(struct memphy_struct *mp, int fpn)
+{
+   static const BYTE zeros[PAGING_PAGESZ];
+
+   if (mp == NULL)
+      return -1;
+
+   if (mp->rdmflg && mp->storage != NULL)
+   {
+      memset(mp->storage + fpn * PAGING_PAGESZ, 0, PAGING_PAGESZ);
+      memphy_mark(mp, fpn);
+      return 0;
+   }
+
+   return MEMPHY_write_page(mp, fpn, zeros);
+}
+
+/*
+ *  MEMPHY_set_swpcopy - remember the swap entry holding a clean copy
+ *                       of a frame, 0 to forget it
+ *  @mp: memphy struct
+ *  @fpn: frame number
+ *  @swpent: swap entry (swapped PTE bits)
+ */
+int MEMPHY_set_swpcopy(struct memphy_struct *mp, int fpn, uint32_t swpent)
+{
+   if (mp->swpcopy == NULL)
+   {
+      if (swpent == 0)
+         return 0;
+
+      mp->swpcopy = calloc(mp->maxsz / PAGING_PAGESZ, sizeof(uint32_t));
+      if (mp->swpcopy == NULL)
+         return -1;
+   }
+
+   mp->swpcopy[fpn] = swpent;
    return 0;
 }
 
+uint32_t MEMPHY_get_swpcopy(struct memphy_struct *mp, int fpn)
+{
+   return (mp->swpcopy != NULL) ? mp->swpcopy[fpn] : 0;
+}
+
+/*
+ *  MEMPHY_get_frame - take one more reference on a frame in use
+ *  @mp: memphy struct
+ *  @fpn: frame number
+ */
+int MEMPHY_get_frame(struct memphy_struct *mp, int fpn)
+{
+   if (mp->frmref == NULL)
+      return -1;
+
+   pthread_mutex_lock(&mp->lock);
+   mp->frmref[fpn]++;
+   pthread_mutex_unlock(&mp->lock);
+
+   return 0;
+}
+
+/*
+ *  MEMPHY_frame_refs - references held on a frame in use
+ *  @mp: memphy struct
+ *  @fpn: frame number
+ */
+int MEMPHY_frame_refs(struct memphy_struct *mp, int fpn)
+{
+   int nref;
+
+   if (mp->frmref == NULL)
+      return 1;
+
+   pthread_mutex_lock(&mp->lock);
+   nref = mp->frmref[fpn];
+   pthread_mutex_unlock(&mp->lock);
+
+   return nref;
+}
+
+/*
+ *  MEMPHY_put_freefp - drop a reference on a frame, the last one puts it
+ *                      back on the free list
+ *  @mp: memphy struct
+ *  @fpn: frame number
+ */
 int MEMPHY_put_freefp(struct memphy_struct *mp, int fpn)
 {
-   struct framephy_struct *fp = mp->free_fp_list;
-   struct framephy_struct *newnode = malloc(sizeof(struct framephy_struct));
+   struct framephy_struct *newnode;
+
+   pthread_mutex_lock(&mp->lock);
+   if (mp->frmref != NULL && mp->frmref[fpn] > 1)
+   {
+      mp->frmref[fpn]--;
+      pthread_mutex_unlock(&mp->lock);
+      return 0;
+   }
+   pthread_mutex_unlock(&mp->lock);
 
    /* Create new node with value fpn */
+   newnode = malloc(sizeof(struct framephy_struct));
    newnode->fpn = fpn;
-   newnode->fp_next = fp;
+
+   pthread_mutex_lock(&mp->lock);
+   if (mp->frmref != NULL)
+      mp->frmref[fpn] = 0;
+   newnode->fp_next = mp->free_fp_list;
    mp->free_fp_list = newnode;
+   mp->nfreefp++;
+   pthread_mutex_unlock(&mp->lock);
+
+   return 0;
+}
 
+/*
+ *  MEMPHY_free_frames - number of free frames
+ *  @mp: memphy struct
+ */
+int MEMPHY_free_frames(struct memphy_struct *mp)
+{
+   int n;
+
+   pthread_mutex_lock(&mp->lock);
+   n = mp->nfreefp;
+   pthread_mutex_unlock(&mp->lock);
+
+   return n;
+}
+
+/*
+ *  init_memphy_backend - init MEMPHY struct on a given storage backend
+ *  @mp: memphy struct
+ *  @max_size: size in bytes
+ *  @randomflg: random access device
+ *  @kind: MEMPHY_MEM, MEMPHY_MMAP, MEMPHY_FILE or MEMPHY_ZRAM
+ *  @path: backing file of MEMPHY_MMAP and MEMPHY_FILE
+ *
+ *  Host memory is an anonymous mapping and a backing file is created
+ *  sparse and unlinked once open, so either only takes memory or disk
+ *  blocks for the frames written, and a file never outlives the run.
+ *  The free frame list is left empty, see init_memphy().
+ */
+int init_memphy_backend(struct memphy_struct *mp, int max_size, int randomflg,
+                        int kind, const char *path)
+{
+   uint64_t t0 = memphy_clock_ns();
+
+   memset(mp, 0, sizeof(struct memphy_struct));
+   pthread_mutex_init(&mp->lock, NULL);
+   pthread_mutex_init(&mp->dumplock, NULL);
+   mp->maxsz = max_size;
+   mp->kind = kind;
+   mp->fd = -1;
+   mp->rdmflg = (randomflg != 0) ? 1 : 0;
+
+   if (kind == MEMPHY_MEM)
+   {
+      /* Zero-filled on first touch by the host, a frame never written
+       * takes no memory */
+      if (max_size > 0)
+         mp->storage = mmap(NULL, max_size, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+      if (mp->storage == MAP_FAILED)
+      {
+         mp->storage = NULL;
+         return -1;
+      }
+   }
+   else if (kind == MEMPHY_ZRAM)
+   {
+      if ((mp->zpool = zpool_create(max_size / PAGING_PAGESZ)) == NULL)
+         return -1;
+   }
+   else
+   {
+      if (path == NULL || (mp->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600)) < 0)
+         return -1;
+      unlink(path);
+
+      if (ftruncate(mp->fd, max_size) != 0)
+         return -1;
+
+      if (kind == MEMPHY_MMAP && max_size > 0)
+      {
+         mp->storage = mmap(NULL, max_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED, mp->fd, 0);
+         if (mp->storage == MAP_FAILED)
+         {
+            mp->storage = NULL;
+            return -1;
+         }
+      }
+   }
+
+   /* Content tracking, the list is only touched as frames get written */
+   if (max_size / PAGING_PAGESZ > 0)
+   {
+      int nwords = DIV_ROUND_UP(max_size / PAGING_PAGESZ, 32);
+
+      mp->dirtymap = calloc(nwords, sizeof(uint32_t));
+      mp->usedmap = calloc(nwords, sizeof(uint32_t));
+      mp->dirtylist = malloc(max_size / PAGING_PAGESZ * sizeof(int));
+      if (mp->dirtymap == NULL || mp->usedmap == NULL || mp->dirtylist == NULL)
+         return -1;
+   }
+
+   mp->inittime = memphy_clock_ns() - t0;
    return 0;
 }
 
@@ -184,13 +805,16 @@ int MEMPHY_put_freefp(struct memphy_struct *mp, int fpn)
  */
 int init_memphy(struct memphy_struct *mp, int max_size, int randomflg)
 {
-   mp->storage = (BYTE *)malloc(max_size * sizeof(BYTE));
-   mp->maxsz = max_size;
-   memset(mp->storage, 0, max_size * sizeof(BYTE));
+   if (init_memphy_backend(mp, max_size, randomflg, MEMPHY_MEM, NULL) != 0)
+      return -1;
 
    MEMPHY_format(mp, PAGING_PAGESZ);
 
-   mp->rdmflg = (randomflg != 0) ? 1 : 0;
+   /* Set up now, the swap devices fill it in concurrently */
+   mp->swpcopy = calloc(max_size / PAGING_PAGESZ > 0 ? max_size / PAGING_PAGESZ : 1,
+                        sizeof(uint32_t));
+   mp->frmref = calloc(max_size / PAGING_PAGESZ > 0 ? max_size / PAGING_PAGESZ : 1,
+                       sizeof(uint16_t));
 
    if (!mp->rdmflg) /* Not Ramdom acess device, then it serial device*/
       mp->cursor = 0;
@@ -0,0 +1,479 @@
+// #ifdef MM_PAGING
+/*
+ * PAGING based Memory Management
+ * Page replacement module mm/mm-repl.c
+ */
+
+#include "mm.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Policy lists, FIFO/CLOCK/LRU only use RL_T1
+ *   2Q  : T1 = A1in, T2 = Am, B1 = A1out
+ *   ARC : T1, T2 online, B1, B2 ghosts
+ */
+#define RL_T1 0
+#define RL_T2 1
+#define RL_B1 2
+#define RL_B2 3
+
+#define RL_ONLINE(n) ((n)->list == RL_T1 || (n)->list == RL_T2)
+
+#define PGREPL_HASH_INITSZ 64
+
+/*
+ * Node table: chained hash on pgn
+ */
+static struct pgrepl_node *rl_lookup(struct pgrepl_state *st, int pgn)
+{
+  struct pgrepl_node *n = st->htbl[pgn & (st->hsize - 1)];
+
+  while (n != NULL && n->pgn != pgn)
+    n = n->hnext;
+
+  return n;
+}
+
+static void rl_rehash(struct pgrepl_state *st)
+{
+  int nsize = st->hsize * 2;
+  struct pgrepl_node **ntbl = calloc(nsize, sizeof(struct pgrepl_node *));
+  int i;
+
+  if (ntbl == NULL)
+    return; /* keep the longer chains */
+
+  for (i = 0; i < st->hsize; i++)
+  {
+    struct pgrepl_node *n = st->htbl[i];
+    while (n != NULL)
+    {
+      struct pgrepl_node *nx = n->hnext;
+      n->hnext = ntbl[n->pgn & (nsize - 1)];
+      ntbl[n->pgn & (nsize - 1)] = n;
+      n = nx;
+    }
+  }
+
+  free(st->htbl);
+  st->htbl = ntbl;
+  st->hsize = nsize;
+}
+
+static struct pgrepl_node *rl_insert(struct pgrepl_state *st, int pgn)
+{
+  struct pgrepl_node *n = malloc(sizeof(struct pgrepl_node));
+  int h;
+
+  if (n == NULL)
+    return NULL;
+
+  if (st->hcount >= st->hsize)
+    rl_rehash(st);
+
+  h = pgn & (st->hsize - 1);
+  n->pgn = pgn;
+  n->list = -1;
+  n->prev = n->next = NULL;
+  n->hnext = st->htbl[h];
+  st->htbl[h] = n;
+  st->hcount++;
+
+  return n;
+}
+
+/*
+ * Lists: head is the eviction end, tail the most recent one
+ */
+static void rl_unlink(struct pgrepl_state *st, struct pgrepl_node *n)
+{
+  struct pgrepl_list *l;
+
+  if (n->list < 0)
+    return;
+
+  l = &st->lst[n->list];
+  if (n->prev != NULL)
+    n->prev->next = n->next;
+  else
+    l->head = n->next;
+  if (n->next != NULL)
+    n->next->prev = n->prev;
+  else
+    l->tail = n->prev;
+
+  if (RL_ONLINE(n))
+    st->nres--;
+  l->len--;
+  n->prev = n->next = NULL;
+  n->list = -1;
+}
+
+static void rl_push(struct pgrepl_state *st, int list, struct pgrepl_node *n)
+{
+  struct pgrepl_list *l = &st->lst[list];
+
+  rl_unlink(st, n);
+
+  n->list = list;
+  n->prev = l->tail;
+  n->next = NULL;
+  if (l->tail != NULL)
+    l->tail->next = n;
+  else
+    l->head = n;
+  l->tail = n;
+  l->len++;
+
+  if (RL_ONLINE(n))
+  {
+    st->nres++;
+    if (!st->fixedcap && st->nres > st->cap)
+      st->cap = st->nres;
+  }
+}
+
+static void rl_erase(struct pgrepl_state *st, struct pgrepl_node *n)
+{
+  struct pgrepl_node **pp = &st->htbl[n->pgn & (st->hsize - 1)];
+
+  rl_unlink(st, n);
+
+  while (*pp != n)
+    pp = &(*pp)->hnext;
+  *pp = n->hnext;
+  st->hcount--;
+
+  free(n);
+}
+
+/* Erase the head of a ghost list */
+static void rl_trim(struct pgrepl_state *st, int list)
+{
+  if (st->lst[list].head != NULL)
+    rl_erase(st, st->lst[list].head);
+}
+
+/* Take the head of an online list as victim, remember it on ghost list
+ * or drop it when ghost < 0 */
+static int rl_evict_head(struct pgrepl_state *st, int list, int ghost, int *retpgn)
+{
+  struct pgrepl_node *n = st->lst[list].head;
+
+  if (n == NULL)
+    return -1;
+
+  *retpgn = n->pgn;
+  if (ghost < 0)
+    rl_erase(st, n);
+  else
+    rl_push(st, ghost, n);
+
+  return 0;
+}
+
+/* Common hooks */
+static void rl_map_t1(struct pgrepl_state *st, int pgn)
+{
+  struct pgrepl_node *n = rl_lookup(st, pgn);
+
+  if (n == NULL && (n = rl_insert(st, pgn)) == NULL)
+    return;
+
+  rl_push(st, RL_T1, n);
+}
+
+static void rl_no_access(struct pgrepl_state *st, int pgn)
+{
+}
+
+static void rl_unmap(struct pgrepl_state *st, int pgn)
+{
+  struct pgrepl_node *n = rl_lookup(st, pgn);
+
+  if (n != NULL)
+    rl_erase(st, n);
+}
+
+/*
+ * FIFO - evict the oldest mapped page
+ */
+static int fifo_pick_victim(struct pgrepl_state *st, int *retpgn)
+{
+  return rl_evict_head(st, RL_T1, -1, retpgn);
+}
+
+/*
+ * CLOCK - the hand sweeps the mapping order, a page with its accessed bit
+ * set has the bit cleared and gets a second chance at the tail.
+ */
+static int clock_pick_victim(struct pgrepl_state *st, int *retpgn)
+{
+  struct pgrepl_node *n;
+
+  while ((n = st->lst[RL_T1].head) != NULL)
+  {
+    uint32_t *pte = &st->pgd[n->pgn];
+
+    if (!(*pte & PAGING_PTE_ACCESSED_MASK))
+      break;
+
+    CLRBIT(*pte, PAGING_PTE_ACCESSED_MASK);
+    rl_push(st, RL_T1, n);
+  }
+
+  return rl_evict_head(st, RL_T1, -1, retpgn);
+}
+
+/*
+ * LRU - every access moves the page to the tail
+ */
+static void lru_on_access(struct pgrepl_state *st, int pgn)
+{
+  struct pgrepl_node *n = rl_lookup(st, pgn);
+
+  if (n != NULL && n->list == RL_T1)
+    rl_push(st, RL_T1, n);
+}
+
+/*
+ * 2Q - first use pages queue FIFO in A1in, pages referenced again after
+ * leaving A1in (found in the A1out ghost queue) are promoted to the LRU Am.
+ * Kin = cap/4, Kout = cap/2.
+ */
+static void q2_on_map(struct pgrepl_state *st, int pgn)
+{
+  struct pgrepl_node *n = rl_lookup(st, pgn);
+
+  if (n != NULL && n->list == RL_B1)
+  {
+    rl_push(st, RL_T2, n);
+    return;
+  }
+
+  if (n == NULL && (n = rl_insert(st, pgn)) == NULL)
+    return;
+
+  if (!RL_ONLINE(n))
+    rl_push(st, RL_T1, n);
+}
+
+static void q2_on_access(struct pgrepl_state *st, int pgn)
+{
+  struct pgrepl_node *n = rl_lookup(st, pgn);
+
+  if (n != NULL && n->list == RL_T2)
+    rl_push(st, RL_T2, n);
+}
+
+static int q2_pick_victim(struct pgrepl_state *st, int *retpgn)
+{
+  int kin = st->cap / 4 > 0 ? st->cap / 4 : 1;
+  int kout = st->cap / 2 > 0 ? st->cap / 2 : 1;
+
+  if (st->lst[RL_T1].len > kin || st->lst[RL_T2].len == 0)
+  {
+    if (rl_evict_head(st, RL_T1, RL_B1, retpgn) != 0)
+      return -1;
+    while (st->lst[RL_B1].len > kout)
+      rl_trim(st, RL_B1);
+    return 0;
+  }
+
+  return rl_evict_head(st, RL_T2, -1, retpgn);
+}
+
+/*
+ * ARC - T1 holds pages seen once, T2 pages seen at least twice. Hits in
+ * the ghost lists B1/B2 move the T1 target size p towards recency or
+ * frequency.
+ */
+static void arc_on_map(struct pgrepl_state *st, int pgn)
+{
+  struct pgrepl_node *n = rl_lookup(st, pgn);
+  int c = st->cap > 0 ? st->cap : 1;
+  int b1 = st->lst[RL_B1].len, b2 = st->lst[RL_B2].len;
+
+  if (n != NULL && n->list == RL_B1)
+  {
+    st->p += (b2 / b1 > 1) ? b2 / b1 : 1;
+    if (st->p > c)
+      st->p = c;
+    rl_push(st, RL_T2, n);
+    return;
+  }
+
+  if (n != NULL && n->list == RL_B2)
+  {
+    st->p -= (b1 / b2 > 1) ? b1 / b2 : 1;
+    if (st->p < 0)
+      st->p = 0;
+    rl_push(st, RL_T2, n);
+    return;
+  }
+
+  if (n != NULL)
+    return; /* already online */
+
+  /* Keep |T1| + |B1| <= c and the directory within 2c */
+  if (st->lst[RL_T1].len + b1 >= c && b1 > 0)
+    rl_trim(st, RL_B1);
+  if (st->nres + st->lst[RL_B1].len + st->lst[RL_B2].len >= 2 * c)
+    rl_trim(st, RL_B2);
+
+  if ((n = rl_insert(st, pgn)) != NULL)
+    rl_push(st, RL_T1, n);
+}
+
+static void arc_on_access(struct pgrepl_state *st, int pgn)
+{
+  struct pgrepl_node *n = rl_lookup(st, pgn);
+
+  if (n != NULL && RL_ONLINE(n))
+    rl_push(st, RL_T2, n);
+}
+
+static int arc_pick_victim(struct pgrepl_state *st, int *retpgn)
+{
+  int t1 = st->lst[RL_T1].len;
+
+  if (t1 > 0 && (t1 > st->p || st->lst[RL_T2].len == 0))
+    return rl_evict_head(st, RL_T1, RL_B1, retpgn);
+
+  return rl_evict_head(st, RL_T2, RL_B2, retpgn);
+}
+
+static const struct pgrepl_ops fifo_ops = {
+  "fifo", rl_map_t1, rl_no_access, rl_unmap, fifo_pick_victim
+};
+
+static const struct pgrepl_ops clock_ops = {
+  "clock", rl_map_t1, rl_no_access, rl_unmap, clock_pick_victim
+};
+
+static const struct pgrepl_ops lru_ops = {
+  "lru", rl_map_t1, lru_on_access, rl_unmap, fifo_pick_victim
+};
+
+static const struct pgrepl_ops q2_ops = {
+  "2q", q2_on_map, q2_on_access, rl_unmap, q2_pick_victim
+};
+
+static const struct pgrepl_ops arc_ops = {
+  "arc", arc_on_map, arc_on_access, rl_unmap, arc_pick_victim
+};
+
+const struct pgrepl_ops *pgrepl_policies[] = {
+  &fifo_ops, &clock_ops, &lru_ops, &q2_ops, &arc_ops, NULL
+};
+
+/* Policy given to every new mm */
+const struct pgrepl_ops *pgrepl_policy = NULL;
+
+/*
+ * pgrepl_lookup - find a replacement policy by name
+ */
+const struct pgrepl_ops *pgrepl_lookup(const char *name)
+{
+  int i;
+
+  for (i = 0; pgrepl_policies[i] != NULL; i++)
+    if (strcmp(pgrepl_policies[i]->name, name) == 0)
+      return pgrepl_policies[i];
+
+  return NULL;
+}
+
+/*
+ * pgrepl_select - set the replacement policy of new mm
+ */
+int pgrepl_select(const char *name)
+{
+  const struct pgrepl_ops *ops = pgrepl_lookup(name);
+
+  if (ops == NULL)
+    return -1;
+
+  pgrepl_policy = ops;
+  return 0;
+}
+
+/*
+ * pgrepl_create - create replacement state
+ * @ops : policy, NULL for the selected one
+ * @pgd : page table holding the accessed bits
+ * @cap : cache size, 0 to follow the high-water of online pages
+ */
+struct pgrepl_state *pgrepl_create(const struct pgrepl_ops *ops, uint32_t *pgd, int cap)
+{
+  struct pgrepl_state *st = calloc(1, sizeof(struct pgrepl_state));
+
+  if (st == NULL)
+    return NULL;
+
+  if (ops == NULL)
+  {
+    if (pgrepl_policy == NULL)
+      pgrepl_select(MM_PGREPL);
+    ops = pgrepl_policy;
+  }
+
+  st->htbl = calloc(PGREPL_HASH_INITSZ, sizeof(struct pgrepl_node *));
+  if (st->htbl == NULL)
+  {
+    free(st);
+    return NULL;
+  }
+
+  st->ops = ops;
+  st->pgd = pgd;
+  st->hsize = PGREPL_HASH_INITSZ;
+  st->cap = cap;
+  st->fixedcap = (cap > 0);
+
+  return st;
+}
+
+void pgrepl_destroy(struct pgrepl_state *st)
+{
+  int i;
+
+  if (st == NULL)
+    return;
+
+  for (i = 0; i < st->hsize; i++)
+  {
+    struct pgrepl_node *n = st->htbl[i];
+    while (n != NULL)
+    {
+      struct pgrepl_node *nx = n->hnext;
+      free(n);
+      n = nx;
+    }
+  }
+
+  free(st->htbl);
+  free(st);
+}
+
+void pgrepl_on_map(struct pgrepl_state *st, int pgn)
+{
+  st->ops->on_map(st, pgn);
+}
+
+void pgrepl_on_access(struct pgrepl_state *st, int pgn)
+{
+  st->ops->on_access(st, pgn);
+}
+
+void pgrepl_on_unmap(struct pgrepl_state *st, int pgn)
+{
+  st->ops->on_unmap(st, pgn);
+}
+
+int pgrepl_pick_victim(struct pgrepl_state *st, int *retpgn)
+{
+  return st->ops->pick_victim(st, retpgn);
+}
+
+// #endif
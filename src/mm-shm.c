@@ -0,0 +1,470 @@
+// #ifdef MM_PAGING
+/*
+ * PAGING based Memory Management
+ * Shared memory segments mm/mm-shm.c
+ */
+
+/*
+ * A segment is named by a key: shmget creates it on first use, shmat maps
+ * it into a new mmap area of the caller, shmdt removes that area. All the
+ * processes attached to a segment map the same MEMRAM frames, at the
+ * address of their own area.
+ *
+ * The segment keeps the state of each of its pages with the PTE encoding:
+ * online with its frame, swapped out with its slot, or 0 when never
+ * touched. A frame holds one reference for the segment and one per
+ * process mapping it, see MEMPHY_get_frame(). The page tables of the
+ * mappers start reserved and take the frame of the segment on their first
+ * touch, so a page is read from MEMSWP once whoever faults first.
+ *
+ * A shared page is swapped out only when every mapper can drop it at
+ * once: unless the evicting process is the only one mapping the frame,
+ * its eviction takes the mm lock of each other mapper with
+ * pthread_mutex_trylock and leaves the page online when one is busy. The
+ * page tables that mapped it go back to reserved, the segment keeps the
+ * slot.
+ *
+ * A detach writes out the pages no other process maps any more, so that
+ * the frames of a segment nobody maps can be reused. Segments are charged
+ * against the commit limit on creation and live until the system stops.
+ */
+
+#include "mm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+struct shm_map {
+  struct pcb_t *proc;
+  struct vm_area_struct *vma;
+  struct shm_map *next;
+};
+
+struct shm_seg {
+  int key;
+  int npages;
+  pthread_mutex_t lock;  /* pages and mappers */
+  uint32_t *pte;
+  struct shm_map *maps;
+  int nattach;
+};
+
+static struct shm_seg *shm_segs[PAGING_MAX_SHM];
+static int shm_nseg = 0;
+static pthread_mutex_t shm_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct shm_seg *shm_lookup(int key)
+{
+  int i;
+
+  for (i = 0; i < shm_nseg; i++)
+    if (shm_segs[i]->key == key)
+      return shm_segs[i];
+
+  return NULL;
+}
+
+/* The first mapping of its process, whose mm lock the eviction takes */
+static int shm_map_first(struct shm_seg *seg, struct shm_map *map)
+{
+  struct shm_map *m;
+
+  for (m = seg->maps; m != map; m = m->next)
+    if (m->proc->mm == map->proc->mm)
+      return 0;
+
+  return 1;
+}
+
+/* Release the mm locks taken by shm_evict() on the mappers before upto */
+static void shm_unlock_mappers(struct shm_seg *seg, struct mm_struct *mm,
+                               struct shm_map *upto)
+{
+  struct shm_map *m;
+
+  for (m = seg->maps; m != upto; m = m->next)
+    if (m->proc->mm != mm && shm_map_first(seg, m))
+      pthread_mutex_unlock(&m->proc->mm->lock);
+}
+
+/*
+ * Write an online page of a segment out to MEMSWP and drop the reference
+ * of the segment on its frame, with the segment lock held
+ */
+static int shm_page_out(struct pcb_t *caller, struct shm_seg *seg, int idx,
+                        int swptyp, int swpoff)
+{
+  int fpn = PAGING_FPN(seg->pte[idx]);
+
+  swap_writepage(caller->mram, fpn, caller->mswp[swptyp], swpoff);
+  seg->pte[idx] = 0;
+  pte_set_swap(&seg->pte[idx], swptyp, swpoff);
+  MEMPHY_put_freefp(caller->mram, fpn);
+
+  MMSTAT_ADD(shmswpout, 1);
+  return 0;
+}
+
+/*
+ * shm_get - get a segment, created with size bytes if the key is new
+ * @key  : segment key
+ * @size : segment size in bytes
+ *
+ * Return the segment id, -1 on failure.
+ */
+int shm_get(int key, int size)
+{
+  struct shm_seg *seg;
+  int id, npages = PAGING_PAGE_ALIGNSZ(size) / PAGING_PAGESZ;
+
+  pthread_mutex_lock(&shm_lock);
+
+  if ((seg = shm_lookup(key)) != NULL)
+  {
+    for (id = 0; shm_segs[id] != seg; id++)
+      ;
+    pthread_mutex_unlock(&shm_lock);
+    return id;
+  }
+
+  if (size <= 0 || shm_nseg >= PAGING_MAX_SHM)
+  {
+    pthread_mutex_unlock(&shm_lock);
+    return -1;
+  }
+
+  /* The pages are charged once, whatever the number of mappers */
+  if (__atomic_add_fetch(&vm_committed, npages, __ATOMIC_RELAXED) > vm_commit_limit &&
+      vm_commit_limit > 0)
+  {
+    __atomic_sub_fetch(&vm_committed, npages, __ATOMIC_RELAXED);
+    MMSTAT_ADD(commitfail, 1);
+    pthread_mutex_unlock(&shm_lock);
+    return -1;
+  }
+
+  seg = malloc(sizeof(struct shm_seg));
+  if (seg == NULL || (seg->pte = calloc(npages, sizeof(uint32_t))) == NULL)
+  {
+    free(seg);
+    __atomic_sub_fetch(&vm_committed, npages, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&shm_lock);
+    return -1;
+  }
+  seg->key = key;
+  seg->npages = npages;
+  seg->maps = NULL;
+  seg->nattach = 0;
+  pthread_mutex_init(&seg->lock, NULL);
+
+  id = shm_nseg++;
+  shm_segs[id] = seg;
+
+  pthread_mutex_unlock(&shm_lock);
+  return id;
+}
+
+/*
+ * shm_attach - map a segment into a new mmap area of caller
+ * @caller : caller
+ * @key    : segment key
+ *
+ * Return the vm area id, -1 on failure.
+ */
+int shm_attach(struct pcb_t *caller, int key)
+{
+  struct mm_struct *mm = caller->mm;
+  struct vm_area_struct *vma;
+  struct shm_seg *seg;
+  struct shm_map *map;
+  long end, len;
+  int pgn, vmaid;
+
+  pthread_mutex_lock(&shm_lock);
+  seg = shm_lookup(key);
+  pthread_mutex_unlock(&shm_lock);
+
+  if (seg == NULL || (map = malloc(sizeof(struct shm_map))) == NULL)
+    return -1;
+  len = (long)seg->npages * PAGING_PAGESZ;
+
+  pthread_mutex_lock(&mm->lock);
+
+  if ((end = vm_mmap_gap(mm, len)) < 0 ||
+      (vmaid = vm_area_add(mm, end - len, end, VM_MMAP | VM_SHARED)) < 0)
+  {
+    pthread_mutex_unlock(&mm->lock);
+    free(map);
+    return -1;
+  }
+
+  for (pgn = PAGING_PGN(end - len); pgn < PAGING_PGN(end); pgn++)
+    pte_set_reserve(&mm->pgd[pgn]);
+
+  vma = get_vma_by_num(mm, vmaid);
+  vma->vm_shm = seg;
+  vm_freerg_insert(vma, end - len, end);
+
+  map->proc = caller;
+  map->vma = vma;
+  pthread_mutex_lock(&seg->lock);
+  map->next = seg->maps;
+  seg->maps = map;
+  seg->nattach++;
+  pthread_mutex_unlock(&seg->lock);
+
+  pthread_mutex_unlock(&mm->lock);
+  return vmaid;
+}
+
+/*
+ * shm_fork_map - attach a forked child to the segment of one of its areas
+ * @child : child, with the mm lock of its parent held
+ * @vma   : area of child copied from a shared area of the parent
+ */
+int shm_fork_map(struct pcb_t *child, struct vm_area_struct *vma)
+{
+  struct shm_seg *seg = vma->vm_shm;
+  struct shm_map *map = malloc(sizeof(struct shm_map));
+
+  if (map == NULL)
+    return -1;
+
+  map->proc = child;
+  map->vma = vma;
+  pthread_mutex_lock(&seg->lock);
+  map->next = seg->maps;
+  seg->maps = map;
+  seg->nattach++;
+  pthread_mutex_unlock(&seg->lock);
+
+  return 0;
+}
+
+/*
+ * __shm_detach - unmap a shared area of caller, with the mm lock held
+ * @caller : caller
+ * @vma    : area attached by shm_attach()
+ *
+ * The area itself is left to the caller.
+ */
+int __shm_detach(struct pcb_t *caller, struct vm_area_struct *vma)
+{
+  struct shm_seg *seg = vma->vm_shm;
+  struct shm_map **pm, *map;
+  int idx, pgn, swptyp, swpoff;
+
+  for (pgn = PAGING_PGN(vma->vm_start); pgn < PAGING_PGN(vma->vm_end); pgn++)
+    pg_unmap(caller, pgn);
+
+  pthread_mutex_lock(&seg->lock);
+
+  /* Only the segment holds these frames now */
+  for (idx = 0; idx < seg->npages; idx++)
+  {
+    if (!PAGING_PAGE_ONLINE(seg->pte[idx]) ||
+        MEMPHY_frame_refs(caller->mram, PAGING_FPN(seg->pte[idx])) > 1)
+      continue;
+    if (swap_get_slot(caller->mram, &swptyp, &swpoff) != 0)
+      break;
+    shm_page_out(caller, seg, idx, swptyp, swpoff);
+  }
+
+  for (pm = &seg->maps; *pm != NULL && (*pm)->vma != vma; pm = &(*pm)->next)
+    ;
+  if ((map = *pm) != NULL)
+  {
+    *pm = map->next;
+    seg->nattach--;
+    free(map);
+  }
+  pthread_mutex_unlock(&seg->lock);
+
+  vma->vm_shm = NULL;
+  return 0;
+}
+
+/*
+ * shm_detach - remove a shared area of caller
+ * @caller : caller
+ * @vmaid  : ID of an area attached by shm_attach()
+ */
+int shm_detach(struct pcb_t *caller, int vmaid)
+{
+  struct mm_struct *mm = caller->mm;
+  struct vm_area_struct *vma;
+
+  pthread_mutex_lock(&mm->lock);
+
+  vma = get_vma_by_num(mm, vmaid);
+  if (vma == NULL || vma->vm_shm == NULL)
+  {
+    pthread_mutex_unlock(&mm->lock);
+    return -1;
+  }
+
+  __shm_detach(caller, vma);
+  vm_area_del(mm, vmaid);
+
+  pthread_mutex_unlock(&mm->lock);
+  return 0;
+}
+
+/*
+ * shm_fault - frame of a shared page on the first touch by a mapper,
+ *             with the mm lock of caller held
+ * @caller : caller
+ * @vma    : shared area holding the page
+ * @pgn    : page number in caller
+ * @fpn    : return the frame, with a reference for caller
+ */
+int shm_fault(struct pcb_t *caller, struct vm_area_struct *vma, int pgn, int *fpn)
+{
+  struct shm_seg *seg = vma->vm_shm;
+  int idx = pgn - PAGING_PGN(vma->vm_start);
+  int frmfpn = -1;
+  uint32_t pte;
+
+  pthread_mutex_lock(&seg->lock);
+
+  if (!PAGING_PAGE_ONLINE(seg->pte[idx]))
+  {
+    /* Eviction may pick a page of this segment, let it take the lock */
+    pthread_mutex_unlock(&seg->lock);
+    if (pg_alloc_frame(caller, &frmfpn) != 0)
+      return -1;
+    pthread_mutex_lock(&seg->lock);
+  }
+
+  pte = seg->pte[idx];
+  if (PAGING_PAGE_ONLINE(pte))
+  { /* Online for another mapper, possibly since the frame was taken */
+    if (frmfpn >= 0)
+      MEMPHY_put_freefp(caller->mram, frmfpn);
+    frmfpn = PAGING_FPN(pte);
+    MEMPHY_get_frame(caller->mram, frmfpn);
+    MMSTAT_ADD(shmmap, 1);
+  }
+  else
+  {
+    if (PAGING_PAGE_SWAPPED(pte))
+    {
+      struct memphy_struct *swp = caller->mswp[PAGING_SWPTYP(pte)];
+
+      swap_readpage(swp, PAGING_SWP(pte), caller->mram, frmfpn);
+      swap_free(swp, PAGING_SWP(pte));
+      MMSTAT_ADD(shmswpin, 1);
+    }
+    else
+    {
+      MEMPHY_zero_frame(caller->mram, frmfpn);
+      MMSTAT_ADD(shmzero, 1);
+    }
+
+    /* The reference of the segment */
+    seg->pte[idx] = 0;
+    pte_set_fpn(&seg->pte[idx], frmfpn);
+    MEMPHY_get_frame(caller->mram, frmfpn);
+  }
+
+  pthread_mutex_unlock(&seg->lock);
+
+  *fpn = frmfpn;
+  return 0;
+}
+
+/*
+ * shm_evict - swap a shared page out of every mapper, with the mm lock of
+ *             caller held
+ * @caller : owner of the victim
+ * @vma    : shared area holding the victim
+ * @pgn    : page number of the victim in caller
+ * @fpn    : frame of the victim, left to caller with a single reference
+ *
+ * Return -1, the page left online, when a mapper is busy or MEMSWP full.
+ */
+int shm_evict(struct pcb_t *caller, struct vm_area_struct *vma, int pgn, int fpn)
+{
+  struct mm_struct *mm = caller->mm;
+  struct shm_seg *seg = vma->vm_shm;
+  int idx = pgn - PAGING_PGN(vma->vm_start);
+  int opgn, swptyp, swpoff;
+  struct shm_map *m;
+  uint32_t *opte;
+  int shared;
+
+  pthread_mutex_lock(&seg->lock);
+
+  /* References are only taken under the segment lock: with just the ones
+   * of caller and of the segment, no other page table maps the frame */
+  shared = MEMPHY_frame_refs(caller->mram, fpn) > 2;
+
+  for (m = seg->maps; m != NULL && shared; m = m->next)
+  {
+    if (m->proc->mm == mm || !shm_map_first(seg, m))
+      continue;
+    if (pthread_mutex_trylock(&m->proc->mm->lock) != 0)
+    {
+      shm_unlock_mappers(seg, mm, m);
+      pthread_mutex_unlock(&seg->lock);
+      MMSTAT_ADD(shmbusy, 1);
+      return -1;
+    }
+  }
+
+  if (swap_get_slot(caller->mram, &swptyp, &swpoff) != 0)
+  {
+    if (shared)
+      shm_unlock_mappers(seg, mm, NULL);
+    pthread_mutex_unlock(&seg->lock);
+    return -1;
+  }
+
+  /* Drop the page from every other mapping of it */
+  for (m = seg->maps; m != NULL && shared; m = m->next)
+  {
+    if (m->vma == vma)
+      continue;
+    opgn = PAGING_PGN(m->vma->vm_start) + idx;
+    opte = &m->proc->mm->pgd[opgn];
+    if (!PAGING_PAGE_ONLINE(*opte))
+      continue;
+
+    pgrepl_on_unmap(m->proc->mm->pgrepl, opgn);
+    MEMPHY_put_freefp(caller->mram, fpn);
+    pte_set_reserve(opte);
+  }
+  pte_set_reserve(&mm->pgd[pgn]);
+
+  /* The frame stays with caller */
+  shm_page_out(caller, seg, idx, swptyp, swpoff);
+
+  if (shared)
+    shm_unlock_mappers(seg, mm, NULL);
+  pthread_mutex_unlock(&seg->lock);
+
+  return 0;
+}
+
+/*
+ * print_shm_stats - report the segments
+ */
+int print_shm_stats(void)
+{
+  int i, j, nres;
+
+  for (i = 0; i < shm_nseg; i++)
+  {
+    struct shm_seg *seg = shm_segs[i];
+
+    for (j = 0, nres = 0; j < seg->npages; j++)
+      nres += PAGING_PAGE_ONLINE(seg->pte[j]) ? 1 : 0;
+    printf("Shared segment %d: key %d, %d pages, %d online, %d attached\n",
+           i, seg->key, seg->npages, nres, seg->nattach);
+  }
+
+  return 0;
+}
+
+// #endif
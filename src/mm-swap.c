@@ -0,0 +1,382 @@
+// #ifdef MM_PAGING
+/*
+ * PAGING based Memory Management
+ * Swap slot management mm/mm-swap.c
+ */
+
+/*
+ * Each swap device keeps a bitmap of used slots and a reference count per
+ * slot, a swapped PTE holds one reference.
+ *
+ * The swap cache associates a slot with the MEMRAM frame its content was
+ * swapped in to. While the frame is clean the slot is a valid copy, the
+ * association holds the reference of the PTE and the frame is dropped on
+ * eviction without writing it out again. The frame side of the association
+ * is the swap entry stored by MEMPHY_set_swpcopy() on MEMRAM.
+ *
+ * Slots are striped page by page, round-robin over every swap device of
+ * non-zero size. The device is the swap type of the entry.
+ *
+ * The lock of each device guards its slots, and the swap cache entries of
+ * MEMRAM frames that refer to them.
+ */
+
+#include "mm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define SWAP_MAP_BITS 32
+
+/* Swap cache slots freed per reclaim when the device runs full */
+#define SWAP_RECLAIM_BATCH 4
+
+/* Largest swap-in readahead window, see pg_swapin_readahead() */
+int swap_ra_max = MM_SWAPRA;
+
+static struct memphy_struct *swap_devs[PAGING_MAX_MMSWP];
+static unsigned int swap_rr = 0;
+
+static void swap_stat_inuse(int n)
+{
+  pthread_mutex_lock(&mmstat_lock);
+  mmstat.swpinuse += n;
+  if (mmstat.swpinuse > mmstat.swpmaxuse)
+    mmstat.swpmaxuse = mmstat.swpinuse;
+  pthread_mutex_unlock(&mmstat_lock);
+}
+
+/*
+ * swap_init - set up slot management of a swap device
+ * @mp     : swap device
+ * @swptyp : swap type encoded in the entries of the device
+ *
+ * The slot bitmap replaces the free frame list of the device.
+ */
+int swap_init(struct memphy_struct *mp, int swptyp)
+{
+  struct framephy_struct *fp;
+  int nslots = mp->maxsz / PAGING_PAGESZ;
+  int nwords;
+
+  while ((fp = mp->free_fp_list) != NULL)
+  {
+    mp->free_fp_list = fp->fp_next;
+    free(fp);
+  }
+  mp->nfreefp = 0;
+
+  /* Slots past what a swap entry encodes stay unused */
+  if (nslots > (int)(PAGING_PTE_SWPOFF_MASK >> PAGING_PTE_SWPOFF_LOBIT) + 1)
+    nslots = (PAGING_PTE_SWPOFF_MASK >> PAGING_PTE_SWPOFF_LOBIT) + 1;
+  nwords = (nslots + SWAP_MAP_BITS - 1) / SWAP_MAP_BITS;
+
+  mp->nslots = nslots;
+  mp->scanpos = 0;
+  mp->reclaimpos = 0;
+  mp->slotmap = calloc(nwords > 0 ? nwords : 1, sizeof(uint32_t));
+  mp->slotref = calloc(nslots > 0 ? nslots : 1, sizeof(uint16_t));
+  mp->slotfrm = calloc(nslots > 0 ? nslots : 1, sizeof(int));
+  if (mp->slotmap == NULL || mp->slotref == NULL || mp->slotfrm == NULL)
+    return -1;
+
+  mp->pgin = mp->pgout = 0;
+  mp->iotime = 0;
+  if (nslots > 0 && swptyp >= 0 && swptyp < PAGING_MAX_MMSWP)
+    swap_devs[swptyp] = mp;
+
+  return 0;
+}
+
+/*
+ * swap_alloc - take a free slot, next-fit from the last allocation
+ * @mp   : swap device
+ * @slot : returned slot, with one reference
+ */
+int swap_alloc(struct memphy_struct *mp, int *slot)
+{
+  int nwords = (mp->nslots + SWAP_MAP_BITS - 1) / SWAP_MAP_BITS;
+  int w, i, s;
+
+  if (mp->slotmap == NULL)
+    return -1;
+
+  pthread_mutex_lock(&mp->lock);
+  for (i = 0; i < nwords; i++)
+  {
+    w = (mp->scanpos + i) % nwords;
+    if (mp->slotmap[w] == 0xffffffffu)
+      continue;
+
+    s = w * SWAP_MAP_BITS + __builtin_ctz(~mp->slotmap[w]);
+    if (s >= mp->nslots)
+      continue;
+
+    SETBIT(mp->slotmap[w], BIT(s % SWAP_MAP_BITS));
+    mp->slotref[s] = 1;
+    mp->scanpos = w;
+    pthread_mutex_unlock(&mp->lock);
+
+    swap_stat_inuse(1);
+    *slot = s;
+    return 0;
+  }
+  pthread_mutex_unlock(&mp->lock);
+
+  return -1;
+}
+
+/*
+ * swap_get_slot - take a free slot on the next swap device in turn
+ * @mram   : MEMRAM device, for the swap cache
+ * @swptyp : returned swap type (device)
+ * @slot   : returned slot, with one reference
+ *
+ * Only when every device is full, swap cache slots are reclaimed.
+ */
+int swap_get_slot(struct memphy_struct *mram, int *swptyp, int *slot)
+{
+  int pass, i, t;
+
+  for (pass = 0; pass < 2; pass++)
+  {
+    for (i = 0; i < PAGING_MAX_MMSWP; i++)
+    {
+      t = __atomic_fetch_add(&swap_rr, 1, __ATOMIC_RELAXED) % PAGING_MAX_MMSWP;
+
+      if (swap_devs[t] == NULL)
+        continue;
+      if (pass == 1 && swap_cache_reclaim(swap_devs[t], mram) == 0)
+        continue;
+
+      if (swap_alloc(swap_devs[t], slot) == 0)
+      {
+        *swptyp = t;
+        return 0;
+      }
+    }
+  }
+
+  return -1;
+}
+
+/*
+ * swap_readpage - copy a slot into a MEMRAM frame
+ */
+int swap_readpage(struct memphy_struct *mp, int slot,
+                  struct memphy_struct *mram, int fpn)
+{
+  uint64_t t0 = memphy_clock_ns();
+  int ret = __swap_cp_page(mp, slot, mram, fpn);
+
+  pthread_mutex_lock(&mp->lock);
+  mp->pgin++;
+  mp->iotime += memphy_clock_ns() - t0;
+  pthread_mutex_unlock(&mp->lock);
+
+  return ret;
+}
+
+/*
+ * swap_writepage - copy a MEMRAM frame out to a slot
+ */
+int swap_writepage(struct memphy_struct *mram, int fpn,
+                   struct memphy_struct *mp, int slot)
+{
+  uint64_t t0 = memphy_clock_ns();
+  int ret = __swap_cp_page(mram, fpn, mp, slot);
+
+  pthread_mutex_lock(&mp->lock);
+  mp->pgout++;
+  mp->iotime += memphy_clock_ns() - t0;
+  pthread_mutex_unlock(&mp->lock);
+
+  return ret;
+}
+
+/*
+ * swap_dup - take one more reference on a slot
+ */
+int swap_dup(struct memphy_struct *mp, int slot)
+{
+  if (slot < 0 || slot >= mp->nslots)
+    return -1;
+
+  pthread_mutex_lock(&mp->lock);
+  mp->slotref[slot]++;
+  pthread_mutex_unlock(&mp->lock);
+
+  return 0;
+}
+
+/*
+ * swap_free - drop a reference on a slot, the last one frees it
+ */
+int swap_free(struct memphy_struct *mp, int slot)
+{
+  int freed = 0;
+
+  if (slot < 0 || slot >= mp->nslots)
+    return -1;
+
+  pthread_mutex_lock(&mp->lock);
+  if (mp->slotref[slot] > 0 && --mp->slotref[slot] == 0)
+  {
+    CLRBIT(mp->slotmap[slot / SWAP_MAP_BITS], BIT(slot % SWAP_MAP_BITS));
+    mp->slotfrm[slot] = 0;
+    freed = 1;
+  }
+  pthread_mutex_unlock(&mp->lock);
+
+  if (freed && mp->kind == MEMPHY_ZRAM)
+    zpool_free(mp->zpool, slot);
+  if (freed)
+    swap_stat_inuse(-1);
+
+  return 0;
+}
+
+/*
+ * swap_cache_add - record that a frame holds the content of a slot
+ * @mp     : swap device
+ * @slot   : swap slot
+ * @mram   : MEMRAM device
+ * @fpn    : frame number
+ * @swpent : swap entry of the slot
+ */
+int swap_cache_add(struct memphy_struct *mp, int slot,
+                   struct memphy_struct *mram, int fpn, uint32_t swpent)
+{
+  if (slot < 0 || slot >= mp->nslots)
+    return -1;
+
+  pthread_mutex_lock(&mp->lock);
+  mp->slotfrm[slot] = fpn + 1;
+  MEMPHY_set_swpcopy(mram, fpn, swpent);
+  pthread_mutex_unlock(&mp->lock);
+
+  return 0;
+}
+
+/*
+ * swap_cache_lookup - frame holding the content of a slot, -1 if none
+ */
+int swap_cache_lookup(struct memphy_struct *mp, int slot)
+{
+  int fpn;
+
+  if (slot < 0 || slot >= mp->nslots)
+    return -1;
+
+  pthread_mutex_lock(&mp->lock);
+  fpn = mp->slotfrm[slot] - 1;
+  pthread_mutex_unlock(&mp->lock);
+
+  return fpn;
+}
+
+/*
+ * swap_cache_take - break the association of a frame with its slot
+ * @mram : MEMRAM device
+ * @fpn  : frame of the caller
+ *
+ * Return the swap entry of the slot, whose reference goes to the caller,
+ * or 0 when the frame had no copy or a reclaim took it first.
+ */
+uint32_t swap_cache_take(struct memphy_struct *mram, int fpn)
+{
+  uint32_t swpent = MEMPHY_get_swpcopy(mram, fpn);
+  struct memphy_struct *mp;
+
+  /* Only the owner of the frame sets an entry, only the device lock
+   * clears it: check it again under that lock */
+  if (swpent == 0 || (mp = swap_devs[PAGING_SWPTYP(swpent)]) == NULL)
+    return 0;
+
+  pthread_mutex_lock(&mp->lock);
+  swpent = MEMPHY_get_swpcopy(mram, fpn);
+  if (swpent != 0)
+  {
+    mp->slotfrm[PAGING_SWP(swpent)] = 0;
+    MEMPHY_set_swpcopy(mram, fpn, 0);
+  }
+  pthread_mutex_unlock(&mp->lock);
+
+  return swpent;
+}
+
+/*
+ * swap_cache_reclaim - free a batch of the slots only kept as copies of
+ *                      resident frames, for when the device runs full
+ * @mp   : swap device
+ * @mram : MEMRAM device
+ *
+ * The scan resumes where the last one stopped.
+ */
+int swap_cache_reclaim(struct memphy_struct *mp, struct memphy_struct *mram)
+{
+  int i, slot, nfree = 0;
+
+  pthread_mutex_lock(&mp->lock);
+  for (i = 0; i < mp->nslots && nfree < SWAP_RECLAIM_BATCH; i++)
+  {
+    slot = mp->reclaimpos;
+    mp->reclaimpos = (mp->reclaimpos + 1) % mp->nslots;
+
+    if (mp->slotfrm[slot] == 0 || mp->slotref[slot] != 1)
+      continue;
+
+    MEMPHY_set_swpcopy(mram, mp->slotfrm[slot] - 1, 0);
+    mp->slotfrm[slot] = 0;
+    mp->slotref[slot] = 0;
+    CLRBIT(mp->slotmap[slot / SWAP_MAP_BITS], BIT(slot % SWAP_MAP_BITS));
+    if (mp->kind == MEMPHY_ZRAM)
+      zpool_free(mp->zpool, slot);
+    nfree++;
+  }
+  pthread_mutex_unlock(&mp->lock);
+
+  swap_stat_inuse(-nfree);
+  MMSTAT_ADD(swpreclaim, nfree);
+
+  return nfree;
+}
+
+/*
+ * print_swap_stats - report slot usage and I/O of each swap device
+ */
+int print_swap_stats(void)
+{
+  static const char *kinds[] = { "mem", "mmap", "file", "zram" };
+  int t, slot, nused;
+  unsigned long npg;
+
+  for (t = 0; t < PAGING_MAX_MMSWP; t++)
+  {
+    struct memphy_struct *mp = swap_devs[t];
+
+    if (mp == NULL)
+      continue;
+
+    for (slot = 0, nused = 0; slot < mp->nslots; slot++)
+      nused += (mp->slotref[slot] > 0);
+
+    npg = mp->pgin + mp->pgout;
+    printf("MEMSWP%d [%s]: %d/%d slots, %lu pages in, %lu pages out, "
+           "%.2f us/page, init %.3f ms\n",
+           t, kinds[mp->kind], nused, mp->nslots, mp->pgin, mp->pgout,
+           npg > 0 ? mp->iotime / 1e3 / npg : 0.0, mp->inittime / 1e6);
+    if (!mp->rdmflg)
+      printf("MEMSWP%d sequential: %lu seeks, %.1f KiB avg, %.2f time slots "
+             "of latency\n", t, mp->nseek,
+             mp->nseek > 0 ? mp->seekdist / 1024.0 / mp->nseek : 0.0,
+             mp->iolat);
+    if (mp->kind == MEMPHY_ZRAM)
+      zpool_print_stats(mp->zpool);
+  }
+
+  return 0;
+}
+
+// #endif
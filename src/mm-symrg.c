@@ -0,0 +1,155 @@
+// #ifdef MM_PAGING
+/*
+ * PAGING based Memory Management
+ * Symbol region table mm/mm-symrg.c
+ */
+
+/*
+ * The regions of a process are found by the region id its instructions
+ * name. The table is an open addressing hash on the id with linear
+ * probing: the slots are a power of two, the id is spread by a
+ * multiplicative hash and its top bits pick the home slot.
+ *
+ * No table exists before the first allocation. It starts at
+ * SYMRG_MIN_CAP slots and doubles when half full, so a probe run stays
+ * short. Deletion shifts the following entries of the run back instead of
+ * leaving tombstones.
+ *
+ * Only the owner of the mm uses the table, under mm_struct.lock.
+ */
+
+#include "mm.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define SYMRG_MIN_CAP 16
+
+static int symrg_home(int rgid, int cap)
+{
+  return (int)(((uint32_t)rgid * 2654435761u) >> (32 - __builtin_ctz(cap)));
+}
+
+/* Slot of rgid, or of the free slot ending its probe run */
+static int symrg_slot(struct vm_symrg *tbl, int cap, int rgid)
+{
+  int i = symrg_home(rgid, cap);
+
+  while (tbl[i].used && tbl[i].rgid != rgid)
+    i = (i + 1) & (cap - 1);
+
+  return i;
+}
+
+static int symrg_grow(struct mm_struct *mm)
+{
+  int cap = mm->symrg_cap ? mm->symrg_cap * 2 : SYMRG_MIN_CAP;
+  struct vm_symrg *tbl = calloc(cap, sizeof(struct vm_symrg));
+  int i;
+
+  if (tbl == NULL)
+    return -1;
+
+  for (i = 0; i < mm->symrg_cap; i++)
+    if (mm->symrgtbl[i].used)
+      tbl[symrg_slot(tbl, cap, mm->symrgtbl[i].rgid)] = mm->symrgtbl[i];
+
+  free(mm->symrgtbl);
+  mm->symrgtbl = tbl;
+  mm->symrg_cap = cap;
+
+  return 0;
+}
+
+/*
+ * get_symrg_byid - get mem region by region ID
+ * @mm   : memory region
+ * @rgid : region ID act as symbol index of variable
+ *
+ * Return NULL when no region holds the id.
+ */
+struct vm_rg_struct *get_symrg_byid(struct mm_struct *mm, int rgid)
+{
+  int i;
+
+  if (rgid < 0 || mm->symrg_cap == 0)
+    return NULL;
+
+  i = symrg_slot(mm->symrgtbl, mm->symrg_cap, rgid);
+  return mm->symrgtbl[i].used ? &mm->symrgtbl[i].rg : NULL;
+}
+
+/*
+ * symrg_add - region of an id, a new empty entry when it has none
+ * @mm   : memory region
+ * @rgid : region ID
+ */
+struct vm_rg_struct *symrg_add(struct mm_struct *mm, int rgid)
+{
+  struct vm_symrg *ent;
+
+  if (rgid < 0)
+    return NULL;
+
+  if (2 * (mm->symrg_cnt + 1) > mm->symrg_cap && symrg_grow(mm) != 0)
+    return NULL;
+
+  ent = &mm->symrgtbl[symrg_slot(mm->symrgtbl, mm->symrg_cap, rgid)];
+  if (!ent->used)
+  {
+    memset(ent, 0, sizeof(struct vm_symrg));
+    ent->rgid = rgid;
+    ent->used = 1;
+    mm->symrg_cnt++;
+  }
+
+  return &ent->rg;
+}
+
+/*
+ * symrg_del - drop the entry of an id
+ * @mm   : memory region
+ * @rgid : region ID
+ */
+int symrg_del(struct mm_struct *mm, int rgid)
+{
+  struct vm_symrg *tbl = mm->symrgtbl;
+  int mask = mm->symrg_cap - 1;
+  int i, j, h;
+
+  if (rgid < 0 || mm->symrg_cap == 0)
+    return -1;
+
+  i = symrg_slot(tbl, mm->symrg_cap, rgid);
+  if (!tbl[i].used)
+    return -1;
+
+  /* Move back every later entry of the run whose home is not in (i, j] */
+  for (j = (i + 1) & mask; tbl[j].used; j = (j + 1) & mask)
+  {
+    h = symrg_home(tbl[j].rgid, mm->symrg_cap);
+    if (((j - h) & mask) >= ((j - i) & mask))
+    {
+      tbl[i] = tbl[j];
+      i = j;
+    }
+  }
+
+  tbl[i].used = 0;
+  mm->symrg_cnt--;
+
+  return 0;
+}
+
+/*
+ * symrg_destroy - release the table
+ * @mm : memory region
+ */
+void symrg_destroy(struct mm_struct *mm)
+{
+  free(mm->symrgtbl);
+  mm->symrgtbl = NULL;
+  mm->symrg_cap = 0;
+  mm->symrg_cnt = 0;
+}
+
+// #endif
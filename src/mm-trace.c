@@ -0,0 +1,112 @@
+// #ifdef MM_PAGING
+/*
+ * PAGING based Memory Management
+ * Page access trace mm/mm-trace.c
+ */
+
+#include "mm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#define PGTRACE_BUFSZ 4096
+
+static FILE *tracefp = NULL;
+static uint32_t tracebuf[PGTRACE_BUFSZ];
+static int tracelen = 0;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void pgtrace_flush(void)
+{
+  if (tracelen > 0)
+    fwrite(tracebuf, sizeof(uint32_t), tracelen, tracefp);
+  tracelen = 0;
+}
+
+/*
+ * pgtrace_open - start recording page accesses
+ * @path : trace file
+ */
+int pgtrace_open(const char *path)
+{
+  uint32_t hdr[2] = { PGTRACE_MAGIC, PGTRACE_VERSION };
+
+  if ((tracefp = fopen(path, "wb")) == NULL)
+    return -1;
+
+  fwrite(hdr, sizeof(uint32_t), 2, tracefp);
+  return 0;
+}
+
+/*
+ * pgtrace_record - append an access to the trace
+ * @pid : process id
+ * @pgn : page number
+ * @wr  : write access
+ */
+void pgtrace_record(int pid, int pgn, int wr)
+{
+  if (tracefp == NULL)
+    return;
+
+  pthread_mutex_lock(&trace_lock);
+  tracebuf[tracelen++] = PGTRACE_REC(pid, pgn, wr);
+  if (tracelen == PGTRACE_BUFSZ)
+    pgtrace_flush();
+  pthread_mutex_unlock(&trace_lock);
+}
+
+int pgtrace_close(void)
+{
+  if (tracefp == NULL)
+    return 0;
+
+  pthread_mutex_lock(&trace_lock);
+  pgtrace_flush();
+  fclose(tracefp);
+  tracefp = NULL;
+  pthread_mutex_unlock(&trace_lock);
+
+  return 0;
+}
+
+/*
+ * pgtrace_load - read a whole trace file
+ * @path : trace file
+ * @recs : returned records, to be freed by caller
+ * @nrec : returned number of records
+ */
+int pgtrace_load(const char *path, uint32_t **recs, long *nrec)
+{
+  FILE *fp;
+  uint32_t hdr[2];
+  long sz;
+
+  if ((fp = fopen(path, "rb")) == NULL)
+    return -1;
+
+  if (fread(hdr, sizeof(uint32_t), 2, fp) != 2 ||
+      hdr[0] != PGTRACE_MAGIC || hdr[1] != PGTRACE_VERSION)
+  {
+    fclose(fp);
+    return -1;
+  }
+
+  fseek(fp, 0, SEEK_END);
+  sz = (ftell(fp) - sizeof(hdr)) / sizeof(uint32_t);
+  fseek(fp, sizeof(hdr), SEEK_SET);
+
+  *recs = malloc((sz > 0 ? sz : 1) * sizeof(uint32_t));
+  if (*recs == NULL)
+  {
+    fclose(fp);
+    return -1;
+  }
+
+  *nrec = fread(*recs, sizeof(uint32_t), sz, fp);
+  fclose(fp);
+
+  return 0;
+}
+
+// #endif
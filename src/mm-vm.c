@@ -27,6 +27,15 @@ struct vm_rg_struct {
 };
 */
 
+/* Reserve heap growth without frames, see vm_reserve_ram() */
+int vm_lazy_alloc = 0;
+
+/* Heap growth is charged in pages against a limit of vm_overcommit_ratio
+ * percent of RAM plus swap, set up at boot. No limit when it is 0. */
+int vm_overcommit_ratio = MM_OVERCOMMIT;
+long vm_commit_limit = 0;
+long vm_committed = 0;
+
 /*get_vma_by_num - get vm area by numID
  *@mm: memory region
  *@vmaid: ID vm area to alloc memory region
@@ -34,25 +43,97 @@ struct vm_rg_struct {
  */
 struct vm_area_struct *get_vma_by_num(struct mm_struct *mm, int vmaid)
 {
-  struct vm_area_struct *pvma = mm->mmap;
-
-  if (mm->mmap == NULL)
+  if (vmaid < 0 || vmaid >= mm->vma_nid)
     return NULL;
 
-  int vmait = pvma->vm_id;
+  return mm->vma_byid[vmaid];
+}
 
-  while (vmait < vmaid)
+/* Index of the first VMA by address ending after addr */
+static int vma_addr_index(struct mm_struct *mm, unsigned long addr)
+{
+  int lo = 0, hi = mm->vma_cnt;
+
+  while (lo < hi)
   {
-    if (pvma == NULL)
-      return NULL;
+    int mid = (lo + hi) / 2;
 
-    pvma = pvma->vm_next;
-    if (pvma == NULL)
-      return NULL;
-    vmait = pvma->vm_id;
+    if (mm->vma_byaddr[mid]->vm_end > addr)
+      hi = mid;
+    else
+      lo = mid + 1;
   }
 
-  return pvma;
+  return lo;
+}
+
+/*get_vma_by_addr - get the vm area holding an address
+ *@mm: memory region
+ *@addr: virtual address
+ *
+ */
+struct vm_area_struct *get_vma_by_addr(struct mm_struct *mm, unsigned long addr)
+{
+  int i = vma_addr_index(mm, addr);
+
+  if (i < mm->vma_cnt && mm->vma_byaddr[i]->vm_start <= addr)
+    return mm->vma_byaddr[i];
+
+  return NULL;
+}
+
+/*vm_area_add - add a vm area to an mm
+ *@mm: memory region
+ *@start: area start
+ *@end: area end
+ *@flags: VM_GROWSDOWN, VM_MMAP
+ *
+ * The area takes the next id. Return the id, -1 when out of memory.
+ */
+int vm_area_add(struct mm_struct *mm, unsigned long start, unsigned long end,
+                unsigned long flags)
+{
+  struct vm_area_struct *vma = malloc(sizeof(struct vm_area_struct));
+  struct vm_area_struct **byid, **byaddr, **pvma;
+  int i;
+
+  byid = realloc(mm->vma_byid, (mm->vma_nid + 1) * sizeof(*byid));
+  if (byid != NULL)
+    mm->vma_byid = byid;
+  byaddr = realloc(mm->vma_byaddr, (mm->vma_cnt + 1) * sizeof(*byaddr));
+  if (byaddr != NULL)
+    mm->vma_byaddr = byaddr;
+  if (vma == NULL || byid == NULL || byaddr == NULL)
+  {
+    free(vma);
+    return -1;
+  }
+
+  vma->vm_id = mm->vma_nid;
+  vma->vm_start = start;
+  vma->vm_end = end;
+  vma->vm_flags = flags;
+  vma->vm_file = 0;
+  vma->vm_shm = NULL;
+  vma->sbrk = (flags & VM_GROWSDOWN) ? start : end;
+  vma->vm_mm = mm;
+  vma->vm_next = NULL;
+  vma->vm_freerg_list = vma->vm_freerg_tail = vma->vm_freerg_root = NULL;
+  vma->vm_freerg_bytes = 0;
+  memset(vma->vm_freerg_bins, 0, sizeof(vma->vm_freerg_bins));
+
+  /* The list keeps the id order */
+  for (pvma = &mm->mmap; *pvma != NULL; pvma = &(*pvma)->vm_next)
+    ;
+  *pvma = vma;
+  mm->vma_byid[mm->vma_nid++] = vma;
+
+  for (i = mm->vma_cnt; i > 0 && mm->vma_byaddr[i - 1]->vm_start > start; i--)
+    mm->vma_byaddr[i] = mm->vma_byaddr[i - 1];
+  mm->vma_byaddr[i] = vma;
+  mm->vma_cnt++;
+
+  return vma->vm_id;
 }
 
 int __mm_swap_page(struct pcb_t *caller, int vicfpn, int swpfpn)
@@ -61,6 +142,42 @@ int __mm_swap_page(struct pcb_t *caller, int vicfpn, int swpfpn)
     return 0;
 }
 
+/*vm_area_del - remove a vm area from an mm, with its free regions
+ *@mm: memory region
+ *@vmaid: ID of the area, never given again
+ *
+ * The pages of the area are left to the caller.
+ */
+int vm_area_del(struct mm_struct *mm, int vmaid)
+{
+  struct vm_area_struct *vma = get_vma_by_num(mm, vmaid);
+  struct vm_area_struct **pvma;
+  struct vm_rg_struct *rg;
+  int i;
+
+  if (vma == NULL)
+    return -1;
+
+  for (pvma = &mm->mmap; *pvma != vma; pvma = &(*pvma)->vm_next)
+    ;
+  *pvma = vma->vm_next;
+  mm->vma_byid[vmaid] = NULL;
+
+  for (i = 0; mm->vma_byaddr[i] != vma; i++)
+    ;
+  for (mm->vma_cnt--; i < mm->vma_cnt; i++)
+    mm->vma_byaddr[i] = mm->vma_byaddr[i + 1];
+
+  while ((rg = vma->vm_freerg_list) != NULL)
+  {
+    vma->vm_freerg_list = rg->rg_next;
+    free(rg);
+  }
+  free(vma);
+
+  return 0;
+}
+
 /*get_vm_area_node_at_brk - get vm area node for a number of pages
  *@caller: caller
  *@vmaid: ID vm area to alloc memory region
@@ -68,27 +185,35 @@ int __mm_swap_page(struct pcb_t *caller, int vicfpn, int swpfpn)
  *@alignedsz: aligned size (in bytes) for mapping (obtained via PAGING_PAGE_ALIGNSZ)
  *
  * This function creates a new vm region node whose boundaries start at the current
- * break pointer (bp) of the pcb and extend by the aligned size. It also bumps the bp.
+ * break (sbrk) of the vm area and extend by the aligned size, downwards for
+ * the stack.
  */
 struct vm_rg_struct *get_vm_area_node_at_brk(struct pcb_t *caller, int vmaid, int size, int alignedsz)
 {
   struct vm_rg_struct *newrg;
-  /* Optionally retrieve current vma if needed:
-     struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
-  */
+  struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
+  if (!cur_vma)
+      return NULL;
+
   newrg = malloc(sizeof(struct vm_rg_struct));
   if (!newrg)
       return NULL;
 
   /* Update the new region boundaries:
-     rg_start is set to the current break pointer,
+     rg_start is set to the current break of the vm area,
      rg_end is set to rg_start + aligned size.
-     Also update the break pointer (bp) in caller.
   */
-  newrg->rg_start = caller->bp;
-  newrg->rg_end = caller->bp + alignedsz;
+  if (cur_vma->vm_flags & VM_GROWSDOWN)
+  {
+    newrg->rg_start = cur_vma->sbrk - alignedsz;
+    newrg->rg_end = cur_vma->sbrk;
+  }
+  else
+  {
+    newrg->rg_start = cur_vma->sbrk;
+    newrg->rg_end = cur_vma->sbrk + alignedsz;
+  }
   newrg->rg_next = NULL;
-  caller->bp += alignedsz;
 
   return newrg;
 }
@@ -99,18 +224,30 @@ struct vm_rg_struct *get_vm_area_node_at_brk(struct pcb_t *caller, int vmaid, in
  *@vmastart: planned start address of the new region
  *@vmaend: planned end address of the new region
  *
- * This function validates that the new planned memory area does not overlap with
- * the current vm area. For simplicity, we assume that if the new rg_start is not
- * below the current vm_end then there is no overlap.
+ * This function validates that the new planned memory area stays in the
+ * address space and overlaps no other vm area. An empty area, the heap or
+ * the stack before their first growth, counts as the point it sits at.
  */
 int validate_overlap_vm_area(struct pcb_t *caller, int vmaid, int vmastart, int vmaend)
 {
-  struct vm_area_struct *vma = get_vma_by_num(caller->mm, vmaid);
-  if (vma == NULL)
-    return -1;
-  /* If the new region starts before the current vm_end, it overlaps */
-  if (vmastart < vma->vm_end)
+  struct mm_struct *mm = caller->mm;
+  struct vm_area_struct *vma;
+  int i;
+
+  if (get_vma_by_num(mm, vmaid) == NULL || vmastart < 0 || vmastart > vmaend ||
+      vmaend > BIT(PAGING_CPU_BUS_WIDTH))
     return -1;
+
+  /* Only the areas from the first one ending after vmastart can overlap */
+  for (i = vma_addr_index(mm, vmastart); i < mm->vma_cnt; i++)
+  {
+    vma = mm->vma_byaddr[i];
+    if (vma->vm_start >= vmaend)
+      break;
+    if (vma->vm_id != vmaid && (vma->vm_start < vma->vm_end || vma->vm_start > vmastart))
+      return -1;
+  }
+
   return 0;
 }
 
@@ -127,43 +264,523 @@ int validate_overlap_vm_area(struct pcb_t *caller, int vmaid, int vmastart, int
 //     return 0;
 // }
 
+/*vm_area_populate - charge and map the pages of a new range of a vm area
+ *@caller: caller
+ *@mapstart: range start, page aligned
+ *@incpgnum: number of pages
+ *
+ * The pages are mapped into MEMRAM, or only reserved in lazy allocation
+ * mode.
+ */
+static int vm_area_populate(struct pcb_t *caller, int mapstart, int incpgnum)
+{
+  struct vm_rg_struct maprg;
+
+  /* Charge the growth, refuse it past the commit limit */
+  if (__atomic_add_fetch(&vm_committed, incpgnum, __ATOMIC_RELAXED) > vm_commit_limit &&
+      vm_commit_limit > 0)
+  {
+    __atomic_sub_fetch(&vm_committed, incpgnum, __ATOMIC_RELAXED);
+    MMSTAT_ADD(commitfail, 1);
+    return -1;
+  }
+
+  /* Map the new memory region into MEMRAM, or only reserve it */
+  if (vm_lazy_alloc)
+    vm_reserve_ram(caller, mapstart, incpgnum);
+  else if (vm_map_ram(caller, mapstart, mapstart + incpgnum * PAGING_PAGESZ,
+                      mapstart, incpgnum, &maprg) < 0)
+  {
+    __atomic_sub_fetch(&vm_committed, incpgnum, __ATOMIC_RELAXED);
+    return -1; /* Mapping failed */
+  }
+
+  caller->mm->committed += incpgnum;
+  return 0;
+}
+
 /*inc_vma_limit - increase vm area limits to reserve space for new variable
  *@caller: caller
  *@vmaid: ID vm area to alloc memory region
  *@inc_sz: increment size in bytes
  *
- * This function increases the memory area limits and maps the additional region.
+ * This function increases the memory area limits and maps the additional region,
+ * or only reserves it in lazy allocation mode. The stack grows down, an
+ * mmap area does not grow.
  */
 int inc_vma_limit(struct pcb_t *caller, int vmaid, int inc_sz)
 {
-  struct vm_rg_struct *newrg_tmp = malloc(sizeof(struct vm_rg_struct));
-  if (!newrg_tmp)
-      return -1;
   int inc_amt = PAGING_PAGE_ALIGNSZ(inc_sz);
   int incnumpage =  inc_amt / PAGING_PAGESZ;
-  struct vm_rg_struct *area = get_vm_area_node_at_brk(caller, vmaid, inc_sz, inc_amt);
-  if (!area)
-      return -1;
   struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
-  if (!cur_vma)
-      return -1;
+  struct vm_rg_struct *area;
 
-  int old_end = cur_vma->vm_end;
+  if (!cur_vma || (cur_vma->vm_flags & VM_MMAP))
+      return -1;
+  area = get_vm_area_node_at_brk(caller, vmaid, inc_sz, inc_amt);
+  if (!area)
+      return -1;
 
   /* Validate that the new area does not overlap */
-  if (validate_overlap_vm_area(caller, vmaid, area->rg_start, area->rg_end) < 0)
-    return -1; /* Overlap detected and failed allocation */
+  if (validate_overlap_vm_area(caller, vmaid, area->rg_start, area->rg_end) < 0 ||
+      vm_area_populate(caller, area->rg_start, incnumpage) < 0)
+  {
+    free(area);
+    return -1; /* Overlap detected or mapping failed */
+  }
 
   /* Extend the current vm area's limit to include the new region */
-  cur_vma->vm_end = area->rg_end;
+  if (cur_vma->vm_flags & VM_GROWSDOWN)
+    cur_vma->vm_start = area->rg_start;
+  else
+    cur_vma->vm_end = area->rg_end;
 
-  /* Map the new memory region into MEMRAM */
-  if (vm_map_ram(caller, area->rg_start, area->rg_end, old_end, incnumpage, newrg_tmp) < 0)
-    return -1; /* Mapping failed */
+  free(area);
+  return 0;
+}
+
+/*vm_mmap_gap - place a new mmap area
+ *@mm: memory region
+ *@len: area size in bytes, page aligned
+ *
+ * The area goes at the highest free addresses below the room of the
+ * stack. Return the end of the area, -1 if no gap is large enough.
+ */
+long vm_mmap_gap(struct mm_struct *mm, unsigned long len)
+{
+  struct vm_area_struct *vma;
+  unsigned long end = BIT(PAGING_CPU_BUS_WIDTH) - PAGING_STACK_MAX;
+  int i;
+
+  /* Top-down: the first gap under end, walking the areas down */
+  for (i = mm->vma_cnt - 1; i >= 0; i--)
+  {
+    vma = mm->vma_byaddr[i];
+    if (vma->vm_start >= end)
+      continue;
+    if (vma->vm_end + len <= end)
+      break;
+    end = vma->vm_start;
+  }
+
+  return (end >= len) ? (long)end : -1;
+}
+
+/*vm_mmap_area - add an mmap area to the caller
+ *@caller: caller
+ *@len: area size in bytes, rounded up to pages, 0 for the whole file
+ *@file: host file mapped from its start (mm-file.c), 0 for anonymous
+ *        memory
+ *
+ * The area, placed by vm_mmap_gap(), starts as one free region. The
+ * pages of a file are only reserved,
+ * they are read in on first touch. Return its vm area id, -1 on failure.
+ */
+int vm_mmap_area(struct pcb_t *caller, int len, int file)
+{
+  struct mm_struct *mm = caller->mm;
+  struct vm_area_struct *vma;
+  long end;
+  int pgn, vmaid;
+
+  if (file != 0 && len == 0)
+    len = mmfile_size(file);
+  if (len <= 0 || (file != 0 && mmfile_extend(file, len) != 0))
+    return -1;
+  len = PAGING_PAGE_ALIGNSZ(len);
+
+  pthread_mutex_lock(&mm->lock);
+
+  if ((end = vm_mmap_gap(mm, len)) < 0)
+  {
+    pthread_mutex_unlock(&mm->lock);
+    return -1;
+  }
+
+  if (file != 0)
+  {
+    for (pgn = PAGING_PGN(end - len); pgn < PAGING_PGN(end); pgn++)
+      pte_set_reserve(&mm->pgd[pgn]);
+  }
+  else if (vm_area_populate(caller, end - len, len / PAGING_PAGESZ) != 0)
+  {
+    pthread_mutex_unlock(&mm->lock);
+    return -1;
+  }
+
+  vmaid = vm_area_add(mm, end - len, end, VM_MMAP);
+  if (vmaid >= 0)
+  {
+    vma = get_vma_by_num(mm, vmaid);
+    vma->vm_file = file;
+    vm_freerg_insert(vma, end - len, end);
+  }
+  else
+  {
+    for (pgn = PAGING_PGN(end - len); pgn < PAGING_PGN(end); pgn++)
+      pg_unmap(caller, pgn);
+  }
+
+  pthread_mutex_unlock(&mm->lock);
+  return vmaid;
+}
+
+/*
+ * Free regions of a VMA
+ *
+ * The free regions are kept in vm_freerg_list, sorted by address so that a
+ * freed range merges with both neighbours, in an AVL tree on the same
+ * order so that those neighbours are found in O(log n), and in size bins
+ * so that an allocation only looks at regions that can hold it. A region
+ * is taken best-fit within the bin of the requested size, otherwise from
+ * the first non empty larger bin, where any region fits.
+ *
+ * Taking from the start of a region moves its start but never past its
+ * successor, so the tree stays ordered without a rebalance. Each node also
+ * keeps the largest size under it, and the VMA the sum of its free bytes,
+ * so vm_freerg_frag() does not walk the regions.
+ */
+
+static int vm_freerg_height(struct vm_rg_struct *rg)
+{
+  return (rg != NULL) ? rg->rg_height : 0;
+}
+
+static void vm_freerg_update(struct vm_rg_struct *rg)
+{
+  int hl = vm_freerg_height(rg->rg_left), hr = vm_freerg_height(rg->rg_right);
+
+  rg->rg_height = ((hl > hr) ? hl : hr) + 1;
+  rg->rg_maxsz = rg->rg_end - rg->rg_start;
+  if (rg->rg_left != NULL && rg->rg_left->rg_maxsz > rg->rg_maxsz)
+    rg->rg_maxsz = rg->rg_left->rg_maxsz;
+  if (rg->rg_right != NULL && rg->rg_right->rg_maxsz > rg->rg_maxsz)
+    rg->rg_maxsz = rg->rg_right->rg_maxsz;
+}
+
+static struct vm_rg_struct *vm_freerg_rotate_left(struct vm_rg_struct *rg)
+{
+  struct vm_rg_struct *r = rg->rg_right;
+
+  rg->rg_right = r->rg_left;
+  r->rg_left = rg;
+  vm_freerg_update(rg);
+  vm_freerg_update(r);
+  return r;
+}
+
+static struct vm_rg_struct *vm_freerg_rotate_right(struct vm_rg_struct *rg)
+{
+  struct vm_rg_struct *l = rg->rg_left;
+
+  rg->rg_left = l->rg_right;
+  l->rg_right = rg;
+  vm_freerg_update(rg);
+  vm_freerg_update(l);
+  return l;
+}
+
+static struct vm_rg_struct *vm_freerg_balance(struct vm_rg_struct *rg)
+{
+  int bf;
+
+  vm_freerg_update(rg);
+  bf = vm_freerg_height(rg->rg_left) - vm_freerg_height(rg->rg_right);
+
+  if (bf > 1)
+  {
+    if (vm_freerg_height(rg->rg_left->rg_left) < vm_freerg_height(rg->rg_left->rg_right))
+      rg->rg_left = vm_freerg_rotate_left(rg->rg_left);
+    return vm_freerg_rotate_right(rg);
+  }
+  if (bf < -1)
+  {
+    if (vm_freerg_height(rg->rg_right->rg_right) < vm_freerg_height(rg->rg_right->rg_left))
+      rg->rg_right = vm_freerg_rotate_right(rg->rg_right);
+    return vm_freerg_rotate_left(rg);
+  }
+
+  return rg;
+}
+
+static struct vm_rg_struct *vm_freerg_tree_add(struct vm_rg_struct *root, struct vm_rg_struct *rg)
+{
+  if (root == NULL)
+  {
+    rg->rg_left = rg->rg_right = NULL;
+    vm_freerg_update(rg);
+    return rg;
+  }
+
+  if (rg->rg_start < root->rg_start)
+    root->rg_left = vm_freerg_tree_add(root->rg_left, rg);
+  else
+    root->rg_right = vm_freerg_tree_add(root->rg_right, rg);
+
+  return vm_freerg_balance(root);
+}
+
+/* Unhook the leftmost node under root into *min */
+static struct vm_rg_struct *vm_freerg_tree_del_min(struct vm_rg_struct *root, struct vm_rg_struct **min)
+{
+  if (root->rg_left == NULL)
+  {
+    *min = root;
+    return root->rg_right;
+  }
+
+  root->rg_left = vm_freerg_tree_del_min(root->rg_left, min);
+  return vm_freerg_balance(root);
+}
+
+static struct vm_rg_struct *vm_freerg_tree_del(struct vm_rg_struct *root, struct vm_rg_struct *rg)
+{
+  struct vm_rg_struct *min;
+
+  if (root == rg)
+  {
+    if (rg->rg_right == NULL)
+      return rg->rg_left;
+    rg->rg_right = vm_freerg_tree_del_min(rg->rg_right, &min);
+    min->rg_left = rg->rg_left;
+    min->rg_right = rg->rg_right;
+    return vm_freerg_balance(min);
+  }
+
+  if (rg->rg_start < root->rg_start)
+    root->rg_left = vm_freerg_tree_del(root->rg_left, rg);
+  else
+    root->rg_right = vm_freerg_tree_del(root->rg_right, rg);
+
+  return vm_freerg_balance(root);
+}
+
+/* Refresh the sizes on the path down to rg, after rg was resized */
+static void vm_freerg_tree_fix(struct vm_rg_struct *root, struct vm_rg_struct *rg)
+{
+  if (root != rg)
+    vm_freerg_tree_fix((rg->rg_start < root->rg_start) ? root->rg_left : root->rg_right, rg);
+  vm_freerg_update(root);
+}
+
+/* The last free region starting before start, NULL if none */
+static struct vm_rg_struct *vm_freerg_before(struct vm_area_struct *vma, unsigned long start)
+{
+  struct vm_rg_struct *rg = vma->vm_freerg_root, *prev = NULL;
+
+  while (rg != NULL)
+  {
+    if (rg->rg_start < start)
+    {
+      prev = rg;
+      rg = rg->rg_right;
+    }
+    else
+      rg = rg->rg_left;
+  }
+
+  return prev;
+}
+
+static int vm_freerg_bin(unsigned long size)
+{
+  int bin = 0;
+
+  for (size >>= 6; size > 0 && bin < VM_FREERG_NBINS - 1; size >>= 1)
+    bin++;
+
+  return bin;
+}
+
+static void vm_freerg_bin_link(struct vm_area_struct *vma, struct vm_rg_struct *rg)
+{
+  struct vm_rg_struct **head = &vma->vm_freerg_bins[vm_freerg_bin(rg->rg_end - rg->rg_start)];
+
+  rg->bin_prev = NULL;
+  rg->bin_next = *head;
+  if (*head != NULL)
+    (*head)->bin_prev = rg;
+  *head = rg;
+}
+
+static void vm_freerg_bin_unlink(struct vm_area_struct *vma, struct vm_rg_struct *rg)
+{
+  if (rg->bin_prev != NULL)
+    rg->bin_prev->bin_next = rg->bin_next;
+  else
+    vma->vm_freerg_bins[vm_freerg_bin(rg->rg_end - rg->rg_start)] = rg->bin_next;
+  if (rg->bin_next != NULL)
+    rg->bin_next->bin_prev = rg->bin_prev;
+}
+
+static void vm_freerg_unlink(struct vm_area_struct *vma, struct vm_rg_struct *rg)
+{
+  vm_freerg_bin_unlink(vma, rg);
+  vma->vm_freerg_root = vm_freerg_tree_del(vma->vm_freerg_root, rg);
+  if (rg->rg_prev != NULL)
+    rg->rg_prev->rg_next = rg->rg_next;
+  else
+    vma->vm_freerg_list = rg->rg_next;
+  if (rg->rg_next != NULL)
+    rg->rg_next->rg_prev = rg->rg_prev;
+  else
+    vma->vm_freerg_tail = rg->rg_prev;
+  free(rg);
+}
+
+/*vm_freerg_insert - give a range back to the free regions of a VMA
+ *@vma: vm area
+ *@start: range start
+ *@end: range end
+ *
+ * The range merges with the free regions right before and after it. A
+ * range overlapping a free region is refused.
+ */
+int vm_freerg_insert(struct vm_area_struct *vma, unsigned long start, unsigned long end)
+{
+  struct vm_rg_struct *prev, *next, *rg;
+
+  if (start >= end)
+    return 0;
+
+  prev = vm_freerg_before(vma, start);
+  next = (prev != NULL) ? prev->rg_next : vma->vm_freerg_list;
+
+  if ((prev != NULL && prev->rg_end > start) || (next != NULL && next->rg_start < end))
+    return -1;
+  vma->vm_freerg_bytes += end - start;
+
+  if (prev != NULL && prev->rg_end == start)
+  {
+    vm_freerg_bin_unlink(vma, prev);
+    prev->rg_end = end;
+    rg = prev;
+    MMSTAT_ADD(rgmerge, 1);
+  }
+  else
+  {
+    if ((rg = init_vm_rg(start, end)) == NULL)
+      return -1;
+    rg->rg_prev = prev;
+    rg->rg_next = next;
+    if (prev != NULL)
+      prev->rg_next = rg;
+    else
+      vma->vm_freerg_list = rg;
+    if (next != NULL)
+      next->rg_prev = rg;
+    else
+      vma->vm_freerg_tail = rg;
+    vma->vm_freerg_root = vm_freerg_tree_add(vma->vm_freerg_root, rg);
+  }
+
+  if (next != NULL && next->rg_start == rg->rg_end)
+  {
+    rg->rg_end = next->rg_end;
+    vm_freerg_unlink(vma, next);
+    MMSTAT_ADD(rgmerge, 1);
+  }
+
+  vm_freerg_tree_fix(vma->vm_freerg_root, rg);
+  vm_freerg_bin_link(vma, rg);
+  return 0;
+}
+
+/*vm_freerg_take - carve size bytes out of the free regions of a VMA
+ *@vma: vm area
+ *@size: requested size
+ *@newrg: returned range
+ *
+ */
+int vm_freerg_take(struct vm_area_struct *vma, unsigned long size, struct vm_rg_struct *newrg)
+{
+  struct vm_rg_struct *rg, *best = NULL;
+  int bin;
+
+  for (bin = vm_freerg_bin(size); bin < VM_FREERG_NBINS && best == NULL; bin++)
+  {
+    for (rg = vma->vm_freerg_bins[bin]; rg != NULL; rg = rg->bin_next)
+    {
+      if (rg->rg_end - rg->rg_start < size)
+        continue;
+      if (best == NULL || rg->rg_end - rg->rg_start < best->rg_end - best->rg_start)
+        best = rg;
+      if (bin > vm_freerg_bin(size) || rg->rg_end - rg->rg_start == size)
+        break;
+    }
+  }
+
+  if (best == NULL)
+    return -1;
+
+  newrg->rg_start = best->rg_start;
+  newrg->rg_end = best->rg_start + size;
+  vma->vm_freerg_bytes -= size;
+
+  if (best->rg_end - best->rg_start == size)
+    vm_freerg_unlink(vma, best);
+  else
+  {
+    vm_freerg_bin_unlink(vma, best);
+    best->rg_start += size;
+    vm_freerg_tree_fix(vma->vm_freerg_root, best);
+    vm_freerg_bin_link(vma, best);
+  }
 
-  /* Successful expansion, free the temporary mapping structure if needed */
-  free(newrg_tmp);
   return 0;
 }
 
-// #endif
\ No newline at end of file
+/*vm_freerg_take_top - take the free region ending at the break, so that
+ *                     the heap only grows by what it lacks
+ *@vma: vm area
+ *
+ * Return the start of the region, -1 if the break has none.
+ */
+long vm_freerg_take_top(struct vm_area_struct *vma)
+{
+  struct vm_rg_struct *rg = vma->vm_freerg_tail;
+  long start;
+
+  if (rg == NULL || rg->rg_end != vma->sbrk)
+    return -1;
+
+  start = rg->rg_start;
+  vma->vm_freerg_bytes -= rg->rg_end - rg->rg_start;
+  vm_freerg_unlink(vma, rg);
+  return start;
+}
+
+/*vm_freerg_take_bottom - take the free region at the break of a VMA
+ *                        growing down, so that it can be extended
+ *@vma: vm area
+ *
+ * Return the end of the region, -1 if the break has none.
+ */
+long vm_freerg_take_bottom(struct vm_area_struct *vma)
+{
+  struct vm_rg_struct *rg = vma->vm_freerg_list;
+  long end;
+
+  if (rg == NULL || rg->rg_start != vma->sbrk)
+    return -1;
+
+  end = rg->rg_end;
+  vma->vm_freerg_bytes -= rg->rg_end - rg->rg_start;
+  vm_freerg_unlink(vma, rg);
+  return end;
+}
+
+/*vm_freerg_frag - external fragmentation of a VMA, per mille of the free
+ *                 bytes that lie outside of the largest free region
+ *@vma: vm area
+ *
+ */
+int vm_freerg_frag(struct vm_area_struct *vma)
+{
+  unsigned long total = vma->vm_freerg_bytes;
+  unsigned long largest = (vma->vm_freerg_root != NULL) ? vma->vm_freerg_root->rg_maxsz : 0;
+
+  return (total > 0) ? (int)(1000 - largest * 1000 / total) : 0;
+}
+
+// #endif
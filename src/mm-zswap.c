@@ -0,0 +1,385 @@
+// #ifdef MM_PAGING
+/*
+ * PAGING based Memory Management
+ * Compressed swap pool mm/mm-zswap.c
+ */
+
+/*
+ * A MEMPHY_ZRAM swap device keeps no flat storage. Each slot written is
+ * compressed and kept in a pool of slabs split into fixed size classes:
+ *   - a page filled with one byte value is only recorded in its slot,
+ *   - otherwise it is LZ compressed, or stored raw when that does not
+ *     make it smaller, into an object of the smallest class that fits.
+ *
+ * LZ stream: a control byte c, then
+ *   c < 0x80 : c + 1 literal bytes
+ *   c >= 0x80: a match of (c & 0x7f) + 3 bytes at distance (next byte) + 1
+ */
+
+#include "mm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define ZPOOL_SLABSZ  4096
+#define ZPOOL_ALIGN   16
+#define ZPOOL_NCLASS  (PAGING_PAGESZ / ZPOOL_ALIGN)
+#define ZPOOL_CLSSZ(cls) (((cls) + 1) * ZPOOL_ALIGN)
+
+#define ZLZ_MINMATCH  3
+#define ZLZ_MAXMATCH  (0x7f + ZLZ_MINMATCH)
+#define ZLZ_MAXLIT    0x80
+#define ZLZ_HBITS     8
+
+/* Slot states */
+#define ZSLOT_EMPTY 0
+#define ZSLOT_SAME  1
+#define ZSLOT_OBJ   2
+
+struct zslot {
+  int handle;        /* slab << 8 | object index */
+  uint16_t len;      /* stored length, PAGING_PAGESZ when raw */
+  BYTE fill;         /* value of a same-filled page */
+  BYTE state;
+};
+
+struct zpool {
+  struct zslot *slots;
+  int nslots;
+
+  BYTE **slabs;
+  int nslab;
+  int slabcap;
+  int freeobj[ZPOOL_NCLASS];  /* free handle list per class, -1 if empty */
+
+  /* Statistics */
+  unsigned long nstore, nsame, nraw, nload;
+  uint64_t origbytes, compbytes;
+  long objbytes;             /* class bytes of the objects in use */
+  long storedbytes;          /* compressed bytes of the objects in use */
+  uint64_t ctime, dtime;
+
+  pthread_mutex_t lock;
+};
+
+/*
+ * LZ compression of a page, -1 when the result is not smaller
+ */
+static int zlz_compress(const BYTE *in, BYTE *out)
+{
+  int16_t head[1 << ZLZ_HBITS];
+  int ip = 0, op = 0, lit = 0;
+  int n, len, cand, h;
+
+  memset(head, 0xff, sizeof(head));
+
+  while (ip + ZLZ_MINMATCH <= PAGING_PAGESZ)
+  {
+    h = ((in[ip] << 5) ^ (in[ip + 1] << 2) ^ in[ip + 2] ^ (in[ip] >> 3)) &
+        ((1 << ZLZ_HBITS) - 1);
+    cand = head[h];
+    head[h] = ip;
+
+    if (cand < 0 || in[cand] != in[ip] || in[cand + 1] != in[ip + 1] ||
+        in[cand + 2] != in[ip + 2])
+    {
+      ip++;
+      continue;
+    }
+
+    len = ZLZ_MINMATCH;
+    while (ip + len < PAGING_PAGESZ && len < ZLZ_MAXMATCH &&
+           in[cand + len] == in[ip + len])
+      len++;
+
+    /* Flush the pending literals, then the match */
+    while (lit < ip)
+    {
+      n = (ip - lit > ZLZ_MAXLIT) ? ZLZ_MAXLIT : ip - lit;
+      if (op + 1 + n >= PAGING_PAGESZ)
+        return -1;
+      out[op++] = n - 1;
+      memcpy(out + op, in + lit, n);
+      op += n;
+      lit += n;
+    }
+
+    if (op + 2 >= PAGING_PAGESZ)
+      return -1;
+    out[op++] = 0x80 | (len - ZLZ_MINMATCH);
+    out[op++] = ip - cand - 1;
+
+    ip += len;
+    lit = ip;
+  }
+
+  while (lit < PAGING_PAGESZ)
+  {
+    n = (PAGING_PAGESZ - lit > ZLZ_MAXLIT) ? ZLZ_MAXLIT : PAGING_PAGESZ - lit;
+    if (op + 1 + n >= PAGING_PAGESZ)
+      return -1;
+    out[op++] = n - 1;
+    memcpy(out + op, in + lit, n);
+    op += n;
+    lit += n;
+  }
+
+  return op;
+}
+
+static int zlz_decompress(const BYTE *in, int len, BYTE *out)
+{
+  int ip = 0, op = 0, n, off;
+
+  while (ip < len)
+  {
+    BYTE c = in[ip++];
+
+    if (c & 0x80)
+    {
+      n = (c & 0x7f) + ZLZ_MINMATCH;
+      if (ip >= len)
+        return -1;
+      off = (uint8_t)in[ip++] + 1;
+      if (off > op || op + n > PAGING_PAGESZ)
+        return -1;
+      for (; n > 0; n--, op++)
+        out[op] = out[op - off];
+    }
+    else
+    {
+      n = c + 1;
+      if (ip + n > len || op + n > PAGING_PAGESZ)
+        return -1;
+      memcpy(out + op, in + ip, n);
+      ip += n;
+      op += n;
+    }
+  }
+
+  return (op == PAGING_PAGESZ) ? 0 : -1;
+}
+
+/*
+ * Slab objects
+ */
+static BYTE *zobj_addr(struct zpool *zp, int handle, int cls)
+{
+  return zp->slabs[handle >> 8] + (handle & 0xff) * ZPOOL_CLSSZ(cls);
+}
+
+static int zobj_alloc(struct zpool *zp, int cls)
+{
+  int handle, i, nobj;
+
+  if (zp->freeobj[cls] < 0)
+  {
+    /* Carve a new slab into objects of the class */
+    if (zp->nslab == zp->slabcap)
+    {
+      int ncap = zp->slabcap ? zp->slabcap * 2 : 16;
+      BYTE **nslabs = realloc(zp->slabs, ncap * sizeof(BYTE *));
+
+      if (nslabs == NULL)
+        return -1;
+      zp->slabs = nslabs;
+      zp->slabcap = ncap;
+    }
+
+    if ((zp->slabs[zp->nslab] = malloc(ZPOOL_SLABSZ)) == NULL)
+      return -1;
+
+    nobj = ZPOOL_SLABSZ / ZPOOL_CLSSZ(cls);
+    for (i = nobj - 1; i >= 0; i--)
+    {
+      handle = (zp->nslab << 8) | i;
+      memcpy(zobj_addr(zp, handle, cls), &zp->freeobj[cls], sizeof(int));
+      zp->freeobj[cls] = handle;
+    }
+    zp->nslab++;
+  }
+
+  handle = zp->freeobj[cls];
+  memcpy(&zp->freeobj[cls], zobj_addr(zp, handle, cls), sizeof(int));
+
+  return handle;
+}
+
+static void zobj_free(struct zpool *zp, int handle, int cls)
+{
+  memcpy(zobj_addr(zp, handle, cls), &zp->freeobj[cls], sizeof(int));
+  zp->freeobj[cls] = handle;
+}
+
+static void zslot_release(struct zpool *zp, struct zslot *zs)
+{
+  if (zs->state == ZSLOT_OBJ)
+  {
+    int cls = (zs->len - 1) / ZPOOL_ALIGN;
+
+    zobj_free(zp, zs->handle, cls);
+    zp->objbytes -= ZPOOL_CLSSZ(cls);
+    zp->storedbytes -= zs->len;
+  }
+  zs->state = ZSLOT_EMPTY;
+}
+
+/*
+ * zpool_create - compressed pool for a swap device
+ * @nslots : number of slots of the device
+ */
+struct zpool *zpool_create(int nslots)
+{
+  struct zpool *zp = calloc(1, sizeof(struct zpool));
+  int cls;
+
+  if (zp == NULL)
+    return NULL;
+
+  zp->slots = calloc(nslots > 0 ? nslots : 1, sizeof(struct zslot));
+  if (zp->slots == NULL)
+  {
+    free(zp);
+    return NULL;
+  }
+  zp->nslots = nslots;
+
+  for (cls = 0; cls < ZPOOL_NCLASS; cls++)
+    zp->freeobj[cls] = -1;
+  pthread_mutex_init(&zp->lock, NULL);
+
+  return zp;
+}
+
+/*
+ * zpool_store - compress a page into a slot
+ * @zp   : pool
+ * @slot : slot of the device
+ * @page : PAGING_PAGESZ bytes
+ */
+int zpool_store(struct zpool *zp, int slot, const BYTE *page)
+{
+  BYTE buf[PAGING_PAGESZ];
+  uint64_t t0 = memphy_clock_ns();
+  struct zslot *zs;
+  int len, cls, i;
+
+  if (slot < 0 || slot >= zp->nslots)
+    return -1;
+
+  for (i = 1; i < PAGING_PAGESZ && page[i] == page[0]; i++)
+    ;
+  len = (i == PAGING_PAGESZ) ? 0 : zlz_compress(page, buf);
+
+  pthread_mutex_lock(&zp->lock);
+  zs = &zp->slots[slot];
+  zslot_release(zp, zs);
+
+  zp->nstore++;
+  zp->origbytes += PAGING_PAGESZ;
+
+  if (len == 0)
+  { /* Same-filled page, nothing goes to the pool */
+    zs->state = ZSLOT_SAME;
+    zs->fill = page[0];
+    zp->nsame++;
+    zp->compbytes += 1;
+  }
+  else
+  {
+    if (len < 0)
+    { /* Incompressible, keep it raw */
+      len = PAGING_PAGESZ;
+      zp->nraw++;
+    }
+
+    cls = (len - 1) / ZPOOL_ALIGN;
+    if ((zs->handle = zobj_alloc(zp, cls)) < 0)
+    {
+      pthread_mutex_unlock(&zp->lock);
+      return -1;
+    }
+    memcpy(zobj_addr(zp, zs->handle, cls),
+           (len == PAGING_PAGESZ) ? page : buf, len);
+
+    zs->state = ZSLOT_OBJ;
+    zs->len = len;
+    zp->compbytes += len;
+    zp->objbytes += ZPOOL_CLSSZ(cls);
+    zp->storedbytes += len;
+  }
+
+  zp->ctime += memphy_clock_ns() - t0;
+  pthread_mutex_unlock(&zp->lock);
+
+  return 0;
+}
+
+/*
+ * zpool_load - decompress a slot into a page, an empty slot reads zeros
+ */
+int zpool_load(struct zpool *zp, int slot, BYTE *page)
+{
+  uint64_t t0 = memphy_clock_ns();
+  struct zslot *zs;
+  int ret = 0;
+
+  if (slot < 0 || slot >= zp->nslots)
+    return -1;
+
+  pthread_mutex_lock(&zp->lock);
+  zs = &zp->slots[slot];
+
+  if (zs->state == ZSLOT_EMPTY)
+    memset(page, 0, PAGING_PAGESZ);
+  else if (zs->state == ZSLOT_SAME)
+    memset(page, zs->fill, PAGING_PAGESZ);
+  else
+  {
+    BYTE *obj = zobj_addr(zp, zs->handle, (zs->len - 1) / ZPOOL_ALIGN);
+
+    if (zs->len == PAGING_PAGESZ)
+      memcpy(page, obj, PAGING_PAGESZ);
+    else
+      ret = zlz_decompress(obj, zs->len, page);
+  }
+
+  zp->nload++;
+  zp->dtime += memphy_clock_ns() - t0;
+  pthread_mutex_unlock(&zp->lock);
+
+  return ret;
+}
+
+/*
+ * zpool_free - drop the content of a slot
+ */
+void zpool_free(struct zpool *zp, int slot)
+{
+  if (slot < 0 || slot >= zp->nslots)
+    return;
+
+  pthread_mutex_lock(&zp->lock);
+  zslot_release(zp, &zp->slots[slot]);
+  pthread_mutex_unlock(&zp->lock);
+}
+
+int zpool_print_stats(struct zpool *zp)
+{
+  long slabbytes = (long)zp->nslab * ZPOOL_SLABSZ;
+
+  printf("  compressed %lu pages (%lu same-filled, %lu raw), "
+         "ratio %.2f\n", zp->nstore, zp->nsame, zp->nraw,
+         zp->compbytes > 0 ? (double)zp->origbytes / zp->compbytes : 0.0);
+  printf("  pool %ld bytes held in %ld/%ld slab bytes (%.1f%% occupied), "
+         "%d slabs\n", zp->storedbytes, zp->objbytes, slabbytes,
+         slabbytes > 0 ? 100.0 * zp->objbytes / slabbytes : 0.0, zp->nslab);
+  printf("  compress %.2f us/page, decompress %.2f us/page\n",
+         zp->nstore > 0 ? zp->ctime / 1e3 / zp->nstore : 0.0,
+         zp->nload > 0 ? zp->dtime / 1e3 / zp->nload : 0.0);
+
+  return 0;
+}
+
+// #endif
@@ -7,6 +7,7 @@
 #include "mm.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 /*
  * init_pte - Initialize PTE entry
@@ -62,6 +63,20 @@ int pte_set_swap(uint32_t *pte, int swptyp, int swpoff)
   return 0;
 }
 
+/*
+ * pte_set_reserve - Set PTE entry for a page given a frame on first touch,
+ *                   counted in mmstat.pgreserved until then or its unmap
+ * @pte   : target page table entry (PTE)
+ */
+int pte_set_reserve(uint32_t *pte)
+{
+  if (!PAGING_PAGE_RESERVED(*pte))
+    MMSTAT_ADD(pgreserved, 1);
+  *pte = PAGING_PTE_RESERVE_MASK;
+
+  return 0;
+}
+
 /*
  * pte_set_swap - Set PTE entry for on-line page
  * @pte   : target page table entry (PTE)
@@ -100,19 +115,18 @@ int vmap_page_range(struct pcb_t *caller,           // process call
    * Here we assume that the frames list is a linked list where each node has field "fpn" and "fp_next".
    */
   struct framephy_struct *cur_frame = frames;
-  int i;
-  for (i = 0; i < pgnum && cur_frame != NULL; i++) {
-      int cur_pgn = PAGING_PGN(addr + i * PAGING_PAGESZ);
+  for (pgit = 0; pgit < pgnum && cur_frame != NULL; pgit++) {
       /* Setting the page table entry:
          we use pte_set_fpn to store the physical frame number along with the PRESENT flag */
-      pte_set_fpn(&caller->mm->pgd[cur_pgn], cur_frame->fpn);
+      pte_set_fpn(&caller->mm->pgd[pgn + pgit], cur_frame->fpn);
+
+      /* Tracking for later page replacement activities
+       * Enqueue new usage page */
+      pgrepl_on_map(caller->mm->pgrepl, pgn + pgit);
+
       cur_frame = cur_frame->fp_next;
   }
 
-  /* Tracking for later page replacement activities (if needed)
-   * Enqueue new usage page */
-  enlist_pgn_node(&caller->mm->fifo_pgn, pgn + pgit);
-
   return 0;
 }
 
@@ -129,7 +143,8 @@ int alloc_pages_range(struct pcb_t *caller, int req_pgnum, struct framephy_struc
 
   for (pgit = 0; pgit < req_pgnum; pgit++)
   {
-      if (MEMPHY_get_freefp(caller->mram, &fpn) == 0)
+      /* Out of free frames, take the frame of a victim page of caller */
+      if (pg_alloc_frame(caller, &fpn) == 0)
       {
           struct framephy_struct *temp = malloc(sizeof(struct framephy_struct));
           if (!temp)
@@ -149,9 +164,16 @@ int alloc_pages_range(struct pcb_t *caller, int req_pgnum, struct framephy_struc
       }
       else
       { 
-          /* If we cannot obtain a free frame for any page, return error code.
-             In a full system, proper cleanup and swap mechanism would be applied.
-          */
+          /* If we cannot obtain a free frame for any page, give back
+           * the frames taken so far and return error code.
+           */
+          while (head != NULL)
+          {
+              tail = head->fp_next;
+              MEMPHY_put_freefp(caller->mram, head->fpn);
+              free(head);
+              head = tail;
+          }
           return -3000; 
       }
   }
@@ -172,24 +194,50 @@ int alloc_pages_range(struct pcb_t *caller, int req_pgnum, struct framephy_struc
 int vm_map_ram(struct pcb_t *caller, int astart, int aend, int mapstart, int incpgnum, struct vm_rg_struct *ret_rg)
 {
   struct framephy_struct *frm_lst = NULL;
-  int ret_alloc;
-
-  ret_alloc = alloc_pages_range(caller, incpgnum, &frm_lst);
+  int pgit, ret_alloc;
 
-  if (ret_alloc < 0 && ret_alloc != -3000)
-    return -1;
-
-  /* Out of memory */
-  if (ret_alloc == -3000)
+  /* Map page by page, so that the pages mapped so far can be evicted to
+   * make room for the rest of a range larger than the free frames */
+  for (pgit = 0; pgit < incpgnum; pgit++)
   {
+    ret_alloc = alloc_pages_range(caller, 1, &frm_lst);
+
+    /* Out of memory */
+    if (ret_alloc < 0)
+    {
 #ifdef MMDBG
-    printf("OOM: vm_map_ram out of memory \n");
+      printf("OOM: vm_map_ram out of memory \n");
 #endif
-    return -1;
+      while (pgit-- > 0)
+        pg_unmap(caller, PAGING_PGN(mapstart) + pgit);
+      return -1;
+    }
+
+    vmap_page_range(caller, mapstart + pgit * PAGING_PAGESZ, 1, frm_lst, ret_rg);
+    free(frm_lst);
   }
 
-  /* Map the pages: this will update the page table mapping for the range */
-  vmap_page_range(caller, mapstart, incpgnum, frm_lst, ret_rg);
+  /* Report the whole mapped range */
+  ret_rg->rg_start = mapstart;
+  ret_rg->rg_end = mapstart + incpgnum * PAGING_PAGESZ;
+
+  return 0;
+}
+
+/*
+ * vm_reserve_ram - reserve a range of pages without frames, each page
+ *                  gets a frame on its first touch in pg_getpage()
+ * @caller    : caller
+ * @mapstart  : start mapping point
+ * @incpgnum  : number of reserved page
+ */
+int vm_reserve_ram(struct pcb_t *caller, int mapstart, int incpgnum)
+{
+  int pgn = PAGING_PGN(mapstart);
+  int pgit;
+
+  for (pgit = 0; pgit < incpgnum; pgit++)
+    pte_set_reserve(&caller->mm->pgd[pgn + pgit]);
 
   return 0;
 }
@@ -203,19 +251,12 @@ int vm_map_ram(struct pcb_t *caller, int astart, int aend, int mapstart, int inc
 int __swap_cp_page(struct memphy_struct *mpsrc, int srcfpn,
                    struct memphy_struct *mpdst, int dstfpn)
 {
-  int cellidx;
-  int addrsrc, addrdst;
-  for (cellidx = 0; cellidx < PAGING_PAGESZ; cellidx++)
-  {
-    addrsrc = srcfpn * PAGING_PAGESZ + cellidx;
-    addrdst = dstfpn * PAGING_PAGESZ + cellidx;
+  BYTE data[PAGING_PAGESZ];
 
-    BYTE data;
-    MEMPHY_read(mpsrc, addrsrc, &data);
-    MEMPHY_write(mpdst, addrdst, data);
-  }
+  if (MEMPHY_read_page(mpsrc, srcfpn, data) != 0)
+    return -1;
 
-  return 0;
+  return MEMPHY_write_page(mpdst, dstfpn, data);
 }
 
 /*
@@ -225,28 +266,59 @@ int __swap_cp_page(struct memphy_struct *mpsrc, int srcfpn,
  */
 int init_mm(struct mm_struct *mm, struct pcb_t *caller)
 {
-  struct vm_area_struct *vma0 = malloc(sizeof(struct vm_area_struct));
-  if (!vma0)
-      return -1;
-  
-  mm->pgd = malloc(PAGING_MAX_PGN * sizeof(uint32_t));
+  mm->pgd = calloc(PAGING_MAX_PGN, sizeof(uint32_t));
   if (!mm->pgd)
       return -1;
 
-  /* By default the owner comes with at least one vma */
-  vma0->vm_id = 0;
-  vma0->vm_start = 0;
-  vma0->vm_end = vma0->vm_start;
-  vma0->sbrk = vma0->vm_start;
-  vma0->vm_next = NULL;  // TODO update VMA0 next: set to NULL
-  struct vm_rg_struct *first_rg = init_vm_rg(vma0->vm_start, vma0->vm_end);
-  enlist_vm_rg_node(&vma0->vm_freerg_list, first_rg);
+  pthread_mutex_init(&mm->lock, NULL);
+  mm->symrgtbl = NULL;
+  mm->symrg_cap = 0;
+  mm->symrg_cnt = 0;
+  mm->pgrepl = pgrepl_create(NULL, mm->pgd, 0);
+  if (!mm->pgrepl)
+      return -1;
+  mm->ra_next = PAGING_MAX_PGN;
+  mm->ra_win = 0;
+  mm->committed = 0;
+  mm->cow_shared = 0;
+  mm->cow_faults = 0;
+  mm->cow_copies = 0;
+
+  /* By default the owner comes with a heap at 0 and a stack at the top,
+   * both empty until their first allocation */
+  mm->mmap = NULL;
+  mm->vma_byid = NULL;
+  mm->vma_byaddr = NULL;
+  mm->vma_nid = 0;
+  mm->vma_cnt = 0;
+  if (vm_area_add(mm, 0, 0, 0) != VMA_HEAP_ID ||
+      vm_area_add(mm, BIT(PAGING_CPU_BUS_WIDTH), BIT(PAGING_CPU_BUS_WIDTH),
+                  VM_GROWSDOWN) != VMA_STACK_ID)
+      return -1;
 
-  /* Point vma owner backward */
-  vma0->vm_mm = mm; 
+  return 0;
+}
 
-  /* update mmap: set the mm->mmap pointer to vma0 */
-  mm->mmap = vma0;
+/*
+ * Release what init_mm() and the areas gave a Memory Management instance,
+ * its pages already collected by free_pcb_memph()
+ * @mm:     self mm, left to the caller
+ */
+int free_mm(struct mm_struct *mm)
+{
+  while (mm->mmap != NULL)
+    vm_area_del(mm, mm->mmap->vm_id);
+  free(mm->vma_byid);
+  free(mm->vma_byaddr);
+  mm->vma_byid = NULL;
+  mm->vma_byaddr = NULL;
+
+  symrg_destroy(mm);
+  pgrepl_destroy(mm->pgrepl);
+  mm->pgrepl = NULL;
+  free(mm->pgd);
+  mm->pgd = NULL;
+  pthread_mutex_destroy(&mm->lock);
 
   return 0;
 }
@@ -258,6 +330,11 @@ struct vm_rg_struct *init_vm_rg(int rg_start, int rg_end)
   rgnode->rg_start = rg_start;
   rgnode->rg_end = rg_end;
   rgnode->rg_next = NULL;
+  rgnode->rg_prev = NULL;
+  rgnode->bin_next = rgnode->bin_prev = NULL;
+  rgnode->rg_left = rgnode->rg_right = NULL;
+  rgnode->rg_height = 1;
+  rgnode->rg_maxsz = rg_end - rg_start;
 
   return rgnode;
 }
@@ -343,28 +420,40 @@ int print_list_pgn(struct pgn_t *ip)
   return 0;
 }
 
-int print_pgtbl(struct pcb_t *caller, uint32_t start, uint32_t end)
+static void print_pgtbl_range(struct pcb_t *caller, uint32_t start, uint32_t end)
 {
-  int pgn_start, pgn_end;
   int pgit;
 
-  if (end == -1)
+  printf("print_pgtbl: %d - %d\n", start, end);
+  for (pgit = PAGING_PGN(start); pgit < PAGING_PGN(end); pgit++)
   {
-    pgn_start = 0;
-    struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, 0);
-    end = cur_vma->vm_end;
+    printf("%08ld: %08x\n", pgit * sizeof(uint32_t), caller->mm->pgd[pgit]);
   }
-  pgn_start = PAGING_PGN(start);
-  pgn_end = PAGING_PGN(end);
+}
 
-  printf("print_pgtbl: %d - %d", start, end);
-  if (caller == NULL) { printf("NULL caller\n"); return -1;}
-  printf("\n");
+int print_pgtbl(struct pcb_t *caller, uint32_t start, uint32_t end)
+{
+  struct vm_area_struct *vma;
+  int i;
+
+  if (caller == NULL) { printf("print_pgtbl: NULL caller\n"); return -1;}
 
-  for (pgit = pgn_start; pgit < pgn_end; pgit++)
+  pthread_mutex_lock(&caller->mm->lock);
+  if (end == -1)
   {
-    printf("%08ld: %08x\n", pgit * sizeof(uint32_t), caller->mm->pgd[pgit]);
+    /* The heap from 0, then the other vm areas in use by address */
+    for (i = 0; i < caller->mm->vma_cnt; i++)
+    {
+      vma = caller->mm->vma_byaddr[i];
+      if (vma->vm_id == VMA_HEAP_ID)
+        print_pgtbl_range(caller, 0, vma->vm_end);
+      else if (vma->vm_start < vma->vm_end)
+        print_pgtbl_range(caller, vma->vm_start, vma->vm_end);
+    }
   }
+  else
+    print_pgtbl_range(caller, start, end);
+  pthread_mutex_unlock(&caller->mm->lock);
 
   return 0;
 }
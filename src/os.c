@@ -17,6 +17,11 @@ static int done = 0;
 #ifdef MM_PAGING
 static int memramsz;
 static int memswpsz[PAGING_MAX_MMSWP];
+static int memswpkind[PAGING_MAX_MMSWP];
+static char memswppath[PAGING_MAX_MMSWP][100];
+static int memswpseq[PAGING_MAX_MMSWP];
+static double memswpseek[PAGING_MAX_MMSWP];
+static double memswpxfer[PAGING_MAX_MMSWP];
 
 struct mmpaging_ld_args {
 	/* A dispatched argument struct to compact many-fields passing to loader */
@@ -56,15 +61,22 @@ static void * cpu_routine(void * args) {
 			/* No process is running, the we load new process from
 		 	* ready queue */
 			proc = get_proc();
-			if (proc == NULL) {
-                           next_slot(timer_id);
-                           continue; /* First load failed. skip dummy load */
-                        }
-		}else if (proc->pc == proc->code->size) {
+		}else if (proc->pc == proc->code->size
+#ifdef MM_PAGING
+		          || proc->oom_killed
+#endif
+		          ) {
 			/* The porcess has finish it job */
 			printf("\tCPU %d: Processed %2d has finished\n",
 				id ,proc->pid);
-			free(proc);
+#ifdef MM_PAGING
+			vm_fork_report(proc);
+			kswapd_unregister(proc);
+			free_pcb_memph(proc);
+			free_mm(proc->mm);
+			free(proc->mm);
+#endif
+			unload(proc);
 			proc = get_proc();
 			time_left = 0;
 		}else if (time_left == 0) {
@@ -95,6 +107,17 @@ static void * cpu_routine(void * args) {
 		run(proc);
 		time_left--;
 		next_slot(timer_id);
+#ifdef MM_PAGING
+		/* The process keeps the CPU for the slots its accesses to
+		 * sequential swap devices took */
+		for (; memphy_iowait >= 1.0; memphy_iowait -= 1.0) {
+			printf("\tCPU %d: Process %2d waits on swap I/O\n",
+				id, proc->pid);
+			if (time_left > 0)
+				time_left--;
+			next_slot(timer_id);
+		}
+#endif
 	}
 	detach_event(timer_id);
 	pthread_exit(NULL);
@@ -105,6 +128,7 @@ static void * ld_routine(void * args) {
 	struct memphy_struct* mram = ((struct mmpaging_ld_args *)args)->mram;
 	struct memphy_struct** mswp = ((struct mmpaging_ld_args *)args)->mswp;
 	struct memphy_struct* active_mswp = ((struct mmpaging_ld_args *)args)->active_mswp;
+	int active_mswp_id = ((struct mmpaging_ld_args *)args)->active_mswp_id;
 	struct timer_id_t * timer_id = ((struct mmpaging_ld_args *)args)->timer_id;
 #else
 	struct timer_id_t * timer_id = (struct timer_id_t*)args;
@@ -125,6 +149,9 @@ static void * ld_routine(void * args) {
 		proc->mram = mram;
 		proc->mswp = mswp;
 		proc->active_mswp = active_mswp;
+		proc->active_mswp_id = active_mswp_id;
+		proc->oom_killed = 0;
+		kswapd_register(proc);
 #endif
 		printf("\tLoaded a process at %s, PID: %d PRIO: %ld\n",
 			ld_processes.path[i], proc->pid, ld_processes.prio[i]);
@@ -140,6 +167,143 @@ static void * ld_routine(void * args) {
 	pthread_exit(NULL);
 }
 
+#ifdef MM_PAGING
+/* Optional memory settings following the memory size line, one
+ * "<key> <value>" pair per line:
+ *   pgrepl  <fifo|clock|lru|2q|arc>  page replacement policy
+ *   pgtrace <file>                   record page accesses for pgsim
+ *   pgalloc <eager|lazy>             give frames at alloc or first touch
+ *   memdump <off|diff|full>          MEMRAM dump after each access: bytes
+ *                                    changed or every frame in use
+ *   swapra  <pages>                  largest swap-in readahead window,
+ *                                    0 disables readahead
+ *   kswapd  <on|off>                 background reclaim thread
+ *   wmark_low  <frames>              free frames waking the reclaim thread
+ *   wmark_high <frames>              free frames it reclaims up to
+ *   ksm     <on|off>                 same-page merging thread
+ *   ksm_pages <pages>                pages it scans per pass
+ *   ksm_sleep <slots>                time slots between two passes
+ *   overcommit <percent>             commit limit in percent of RAM plus
+ *                                    swap, 0 disables the limit
+ *   mmapfile<N> <file>               host file the mmap syscall maps
+ *                                    as file N, from 1, created when
+ *                                    missing
+ *   swpdev<N> <mem|mmap:<file>|file:<file>|zram>
+ *                                    storage of MEMSWP N, host memory by
+ *                                    default, a sparse file either mapped
+ *                                    or accessed by pread/pwrite, or a
+ *                                    pool of compressed pages
+ *   swpseq<N> <seek>,<xfer>          make MEMSWP N sequential, a seek
+ *                                    taking <seek> time slots per MiB
+ *                                    travelled and a page <xfer> slots
+ */
+static const char * mm_option_keys[] = {
+	"pgrepl", "pgtrace", "pgalloc", "memdump", "swapra", "kswapd",
+	"wmark_low", "wmark_high", "ksm", "ksm_pages", "ksm_sleep",
+	"overcommit", NULL
+};
+
+/* A line is an option only when its key is one, anything else is left
+ * to the process lines */
+static int is_mm_option(const char * key) {
+	int i, n;
+
+	for (i = 0; mm_option_keys[i] != NULL; i++)
+		if (!strcmp(key, mm_option_keys[i]))
+			return 1;
+
+	return (sscanf(key, "swpdev%d%n", &i, &n) == 1 && key[n] == '\0') ||
+	       (sscanf(key, "swpseq%d%n", &i, &n) == 1 && key[n] == '\0') ||
+	       (sscanf(key, "mmapfile%d%n", &i, &n) == 1 && key[n] == '\0');
+}
+
+static void read_mm_option(const char * key, const char * val) {
+	int sit;
+
+	if (sscanf(key, "swpdev%d", &sit) == 1) {
+		if (sit < 0 || sit >= PAGING_MAX_MMSWP) {
+			printf("Unknown swap device %s\n", key);
+			exit(1);
+		}
+		if (!strcmp(val, "mem")) {
+			memswpkind[sit] = MEMPHY_MEM;
+		}else if (!strcmp(val, "zram")) {
+			memswpkind[sit] = MEMPHY_ZRAM;
+		}else if (!strncmp(val, "mmap:", 5)) {
+			memswpkind[sit] = MEMPHY_MMAP;
+			strcpy(memswppath[sit], val + 5);
+		}else if (!strncmp(val, "file:", 5)) {
+			memswpkind[sit] = MEMPHY_FILE;
+			strcpy(memswppath[sit], val + 5);
+		}else{
+			printf("Unknown swap storage %s\n", val);
+			exit(1);
+		}
+	}else if (sscanf(key, "swpseq%d", &sit) == 1) {
+		if (sit < 0 || sit >= PAGING_MAX_MMSWP ||
+		    sscanf(val, "%lf,%lf", &memswpseek[sit], &memswpxfer[sit]) != 2 ||
+		    memswpseek[sit] < 0 || memswpxfer[sit] < 0) {
+			printf("Unknown sequential swap setting %s %s\n", key, val);
+			exit(1);
+		}
+		memswpseq[sit] = 1;
+	}else if (sscanf(key, "mmapfile%d", &sit) == 1) {
+		if (mmfile_open(sit, val) != 0) {
+			printf("Cannot open mmap file %s for %s\n", val, key);
+			exit(1);
+		}
+	}else if (!strcmp(key, "pgrepl")) {
+		if (pgrepl_select(val) != 0) {
+			printf("Unknown page replacement policy %s\n", val);
+			exit(1);
+		}
+	}else if (!strcmp(key, "memdump")) {
+		if (MEMPHY_dump_select(val) != 0) {
+			printf("Unknown memory dump mode %s\n", val);
+			exit(1);
+		}
+	}else if (!strcmp(key, "pgalloc")) {
+		if (strcmp(val, "eager") && strcmp(val, "lazy")) {
+			printf("Unknown allocation mode %s\n", val);
+			exit(1);
+		}
+		vm_lazy_alloc = !strcmp(val, "lazy");
+	}else if (!strcmp(key, "swapra")) {
+		swap_ra_max = atoi(val);
+	}else if (!strcmp(key, "kswapd")) {
+		if (strcmp(val, "on") && strcmp(val, "off")) {
+			printf("Unknown kswapd setting %s\n", val);
+			exit(1);
+		}
+		kswapd_enabled = !strcmp(val, "on");
+	}else if (!strcmp(key, "wmark_low")) {
+		kswapd_wmark_low = atoi(val);
+	}else if (!strcmp(key, "wmark_high")) {
+		kswapd_wmark_high = atoi(val);
+	}else if (!strcmp(key, "ksm")) {
+		if (strcmp(val, "on") && strcmp(val, "off")) {
+			printf("Unknown ksm setting %s\n", val);
+			exit(1);
+		}
+		ksm_enabled = !strcmp(val, "on");
+	}else if (!strcmp(key, "ksm_pages")) {
+		ksm_pages = atoi(val);
+	}else if (!strcmp(key, "ksm_sleep")) {
+		ksm_sleep = atoi(val);
+	}else if (!strcmp(key, "overcommit")) {
+		vm_overcommit_ratio = atoi(val);
+	}else if (!strcmp(key, "pgtrace")) {
+		if (pgtrace_open(val) != 0) {
+			printf("Cannot open page trace at %s\n", val);
+			exit(1);
+		}
+	}else{
+		printf("Unknown memory option %s\n", key);
+		exit(1);
+	}
+}
+#endif
+
 static void read_config(const char * path) {
 	FILE * file;
 	if ((file = fopen(path, "r")) == NULL) {
@@ -167,12 +331,28 @@ static void read_config(const char * path) {
 	 * Format: (size=0 result non-used memswap, must have RAM and at least 1 SWAP)
 	 *        MEM_RAM_SZ MEM_SWP0_SZ MEM_SWP1_SZ MEM_SWP2_SZ MEM_SWP3_SZ
 	*/
-	fscanf(file, "%d\n", &memramsz);
-	for(sit = 0; sit < PAGING_MAX_MMSWP; sit++)
-		fscanf(file, "%d", &(memswpsz[sit])); 
+	char line[200];
+	long pos = ftell(file);
 
-       fscanf(file, "\n"); /* Final character */
+	if (fgets(line, sizeof(line), file) == NULL ||
+	    sscanf(line, "%d %d %d %d %d", &memramsz, &memswpsz[0], &memswpsz[1],
+	           &memswpsz[2], &memswpsz[3]) != 1 + PAGING_MAX_MMSWP) {
+		/* A legacy config without the line, leave the line to the
+		 * processes and take the sizes of MM_FIXED_MEMSZ */
+		fseek(file, pos, SEEK_SET);
+		memramsz    =  0x100000;
+		memswpsz[0] = 0x1000000;
+		for(sit = 1; sit < PAGING_MAX_MMSWP; sit++)
+			memswpsz[sit] = 0;
+	}
 #endif
+	char key[32], val[100];
+	pos = ftell(file);
+	while (fscanf(file, "%31s %99s\n", key, val) == 2 && is_mm_option(key)) {
+		read_mm_option(key, val);
+		pos = ftell(file);
+	}
+	fseek(file, pos, SEEK_SET);
 #endif
 
 #ifdef MLQ_SCHED
@@ -218,6 +398,16 @@ int main(int argc, char * argv[]) {
 		args[i].id = i;
 	}
 	struct timer_id_t * ld_event = attach_event();
+#ifdef MM_PAGING
+	struct kswapd_args kswapd_args;
+	struct kswapd_args ksm_args;
+	pthread_t kswapd, ksm;
+
+	if (kswapd_enabled)
+		kswapd_args.timer_id = attach_event();
+	if (ksm_enabled)
+		ksm_args.timer_id = attach_event();
+#endif
 	start_timer();
 
 #ifdef MM_PAGING
@@ -226,23 +416,56 @@ int main(int argc, char * argv[]) {
 
 	struct memphy_struct mram;
 	struct memphy_struct mswp[PAGING_MAX_MMSWP];
+	struct memphy_struct *mswpv[PAGING_MAX_MMSWP];
 
 	/* Create MEM RAM */
+	uint64_t t0 = memphy_clock_ns();
 	init_memphy(&mram, memramsz, rdmflag);
 
         /* Create all MEM SWAP */ 
 	int sit;
 	for(sit = 0; sit < PAGING_MAX_MMSWP; sit++)
-	       init_memphy(&mswp[sit], memswpsz[sit], rdmflag);
+	{
+	       if (init_memphy_backend(&mswp[sit], memswpsz[sit],
+	                               rdmflag && !memswpseq[sit],
+	                               memswpkind[sit], memswppath[sit]) != 0) {
+	               printf("Cannot set up MEMSWP%d storage\n", sit);
+	               exit(1);
+	       }
+	       mswp[sit].seeklat = memswpseek[sit];
+	       mswp[sit].xferlat = memswpxfer[sit];
+	       swap_init(&mswp[sit], sit);
+	       mswpv[sit] = &mswp[sit];
+	}
+	mmstat.devinitns = memphy_clock_ns() - t0;
+
+	/* Commit limit, in pages of RAM plus swap */
+	if (vm_overcommit_ratio > 0) {
+		long npg = memramsz / PAGING_PAGESZ;
+
+		for (sit = 0; sit < PAGING_MAX_MMSWP; sit++)
+			npg += memswpsz[sit] / PAGING_PAGESZ;
+		vm_commit_limit = npg * vm_overcommit_ratio / 100;
+	}
 
 	/* In Paging mode, it needs passing the system mem to each PCB through loader*/
 	struct mmpaging_ld_args *mm_ld_args = malloc(sizeof(struct mmpaging_ld_args));
 
 	mm_ld_args->timer_id = ld_event;
 	mm_ld_args->mram = (struct memphy_struct *) &mram;
-	mm_ld_args->mswp = (struct memphy_struct**) &mswp;
+	mm_ld_args->mswp = mswpv;
 	mm_ld_args->active_mswp = (struct memphy_struct *) &mswp[0];
         mm_ld_args->active_mswp_id = 0;
+
+	/* Background reclaim of MEMRAM */
+	kswapd_args.mram = &mram;
+	if (kswapd_enabled)
+		pthread_create(&kswapd, NULL, kswapd_routine, (void*)&kswapd_args);
+
+	/* Same-page merging across processes */
+	ksm_args.mram = &mram;
+	if (ksm_enabled)
+		pthread_create(&ksm, NULL, ksm_routine, (void*)&ksm_args);
 #endif
 
 	/* Init scheduler */
@@ -264,10 +487,26 @@ int main(int argc, char * argv[]) {
 		pthread_join(cpu[i], NULL);
 	}
 	pthread_join(ld, NULL);
+#ifdef MM_PAGING
+	if (kswapd_enabled) {
+		kswapd_stop();
+		pthread_join(kswapd, NULL);
+	}
+	if (ksm_enabled) {
+		ksm_stop();
+		pthread_join(ksm, NULL);
+	}
+#endif
 
 	/* Stop timer */
 	stop_timer();
 
+#ifdef MM_PAGING
+	pgtrace_close();
+	mmfile_close_all();
+	print_mm_stats();
+#endif
+
 	return 0;
 
 }
@@ -0,0 +1,288 @@
+/*
+ * Offline page replacement simulator
+ *
+ * Replays a page access trace recorded with "pgtrace <file>" through every
+ * replacement policy of mm/mm-repl.c and through Belady's OPT, for a set
+ * of frame counts, and prints the fault rates.
+ *
+ * Usage: pgsim <trace file> [frames ...]
+ *
+ * The frames are a single pool shared by all processes of the trace, pages
+ * are identified by (pid, pgn).
+ */
+
+#include "mm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PGSIM_MAX_FRAMES_ARG 16
+
+static int default_frames[] = { 4, 8, 16, 32, 64, 128 };
+
+/*
+ * Map the (pid, pgn) keys of the trace to dense page ids
+ */
+static int densify(uint32_t *recs, long nrec, int *ids)
+{
+  long hsize = 1024, i;
+  uint32_t *hkey;
+  int *hval;
+  int ndist = 0;
+
+  while (hsize < 2 * nrec && hsize < (1L << 30))
+    hsize <<= 1;
+
+  hkey = malloc(hsize * sizeof(uint32_t));
+  hval = malloc(hsize * sizeof(int));
+  if (hkey == NULL || hval == NULL)
+    return -1;
+  memset(hval, -1, hsize * sizeof(int));
+
+  for (i = 0; i < nrec; i++)
+  {
+    uint32_t key = recs[i] & ~PGTRACE_WRITE_MASK;
+    long h = (key * 2654435761u) & (hsize - 1);
+
+    while (hval[h] >= 0 && hkey[h] != key)
+      h = (h + 1) & (hsize - 1);
+
+    if (hval[h] < 0)
+    {
+      hkey[h] = key;
+      hval[h] = ndist++;
+    }
+    ids[i] = hval[h];
+  }
+
+  free(hkey);
+  free(hval);
+  return ndist;
+}
+
+/*
+ * Belady's OPT: evict the page whose next use is the farthest. Resident
+ * pages sit in a max-heap on next use, stale entries are skipped lazily.
+ */
+struct opt_ent {
+  long nxt;
+  int id;
+};
+
+static void heap_push(struct opt_ent *h, long *n, long nxt, int id)
+{
+  long i = (*n)++;
+
+  while (i > 0 && h[(i - 1) / 2].nxt < nxt)
+  {
+    h[i] = h[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  h[i].nxt = nxt;
+  h[i].id = id;
+}
+
+static struct opt_ent heap_pop(struct opt_ent *h, long *n)
+{
+  struct opt_ent top = h[0], last = h[--(*n)];
+  long i = 0, c;
+
+  while ((c = 2 * i + 1) < *n)
+  {
+    if (c + 1 < *n && h[c + 1].nxt > h[c].nxt)
+      c++;
+    if (h[c].nxt <= last.nxt)
+      break;
+    h[i] = h[c];
+    i = c;
+  }
+  h[i] = last;
+
+  return top;
+}
+
+static long sim_opt(int *ids, long nrec, int ndist, int frames)
+{
+  long *nextuse = malloc(nrec * sizeof(long));
+  long *last = malloc(ndist * sizeof(long));
+  long *curnxt = malloc(ndist * sizeof(long));
+  char *res = calloc(ndist, 1);
+  int *rlist = malloc(frames * sizeof(int));
+  int *rpos = malloc(ndist * sizeof(int));
+  long hcap = 2L * frames + 64;
+  struct opt_ent *heap = malloc(hcap * sizeof(struct opt_ent));
+  long hn = 0, faults = 0, i;
+  int nres = 0, id;
+
+  for (id = 0; id < ndist; id++)
+    last[id] = nrec;
+  for (i = nrec - 1; i >= 0; i--)
+  {
+    nextuse[i] = last[ids[i]];
+    last[ids[i]] = i;
+  }
+
+  for (i = 0; i < nrec; i++)
+  {
+    id = ids[i];
+
+    if (!res[id])
+    {
+      faults++;
+      if (nres == frames)
+      {
+        struct opt_ent e;
+        do
+          e = heap_pop(heap, &hn);
+        while (!res[e.id] || curnxt[e.id] != e.nxt);
+        res[e.id] = 0;
+        rlist[rpos[e.id]] = rlist[--nres];
+        rpos[rlist[nres]] = rpos[e.id];
+      }
+      res[id] = 1;
+      rpos[id] = nres;
+      rlist[nres++] = id;
+    }
+    curnxt[id] = nextuse[i];
+
+    /* Drop stale entries when the heap outgrows the resident set */
+    if (hn == hcap)
+    {
+      int j;
+      hn = 0;
+      for (j = 0; j < nres; j++)
+        if (rlist[j] != id)
+          heap_push(heap, &hn, curnxt[rlist[j]], rlist[j]);
+    }
+    heap_push(heap, &hn, curnxt[id], id);
+  }
+
+  free(nextuse);
+  free(last);
+  free(curnxt);
+  free(res);
+  free(rlist);
+  free(rpos);
+  free(heap);
+  return faults;
+}
+
+/*
+ * Run a policy the way pg_getpage() drives it: a hit sets the accessed
+ * bit and calls on_access, a miss evicts when the pool is full and maps
+ * the page, which is then accessed.
+ */
+static long sim_policy(const struct pgrepl_ops *ops, int *ids, long nrec,
+                       int ndist, int frames)
+{
+  uint32_t *pgd = calloc(ndist, sizeof(uint32_t));
+  struct pgrepl_state *st = pgrepl_create(ops, pgd, frames);
+  long faults = 0, i;
+  int nres = 0, vic;
+
+  for (i = 0; i < nrec; i++)
+  {
+    int id = ids[i];
+
+    if (pgd[id] & PAGING_PTE_PRESENT_MASK)
+      pgrepl_on_access(st, id);
+    else
+    {
+      faults++;
+      if (nres == frames && pgrepl_pick_victim(st, &vic) == 0)
+      {
+        pgd[vic] = 0;
+        nres--;
+      }
+      pgd[id] = PAGING_PTE_PRESENT_MASK;
+      pgrepl_on_map(st, id);
+      nres++;
+    }
+    SETBIT(pgd[id], PAGING_PTE_ACCESSED_MASK);
+  }
+
+  pgrepl_destroy(st);
+  free(pgd);
+  return faults;
+}
+
+static double elapsed(struct timespec *t0)
+{
+  struct timespec t1;
+
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  return (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+  uint32_t *recs;
+  long nrec, nwr = 0, i, replayed = 0;
+  int *ids, ndist, nfrm, f, p;
+  int frames[PGSIM_MAX_FRAMES_ARG];
+  struct timespec t0;
+  double secs;
+
+  if (argc < 2)
+  {
+    printf("Usage: pgsim [trace file] [frames ...]\n");
+    return 1;
+  }
+
+  if (pgtrace_load(argv[1], &recs, &nrec) != 0)
+  {
+    printf("Cannot read page trace at %s\n", argv[1]);
+    return 1;
+  }
+
+  if (argc > 2)
+  {
+    for (nfrm = 0; nfrm < argc - 2 && nfrm < PGSIM_MAX_FRAMES_ARG; nfrm++)
+      frames[nfrm] = atoi(argv[nfrm + 2]) > 0 ? atoi(argv[nfrm + 2]) : 1;
+  }
+  else
+  {
+    nfrm = sizeof(default_frames) / sizeof(int);
+    memcpy(frames, default_frames, sizeof(default_frames));
+  }
+
+  ids = malloc((nrec > 0 ? nrec : 1) * sizeof(int));
+  if (ids == NULL || (ndist = densify(recs, nrec, ids)) < 0)
+  {
+    printf("Out of memory\n");
+    return 1;
+  }
+  for (i = 0; i < nrec; i++)
+    nwr += PGTRACE_WRITE(recs[i]);
+
+  printf("trace %s: %ld accesses (%ld reads, %ld writes), %d distinct pages\n",
+         argv[1], nrec, nrec - nwr, nwr, ndist);
+  if (nrec == 0)
+    return 0;
+
+  printf("fault rate (%%)\n%8s %8s", "frames", "opt");
+  for (p = 0; pgrepl_policies[p] != NULL; p++)
+    printf(" %8s", pgrepl_policies[p]->name);
+  printf("\n");
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (f = 0; f < nfrm; f++)
+  {
+    printf("%8d %8.2f", frames[f],
+           100.0 * sim_opt(ids, nrec, ndist, frames[f]) / nrec);
+    for (p = 0; pgrepl_policies[p] != NULL; p++)
+      printf(" %8.2f", 100.0 * sim_policy(pgrepl_policies[p], ids, nrec,
+                                          ndist, frames[f]) / nrec);
+    printf("\n");
+    replayed += nrec * (p + 1);
+  }
+  secs = elapsed(&t0);
+
+  printf("replayed %ld accesses in %.3f s (%.2f M accesses/s)\n",
+         replayed, secs, secs > 0 ? replayed / secs / 1e6 : 0.0);
+
+  free(ids);
+  free(recs);
+  return 0;
+}
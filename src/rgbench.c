@@ -0,0 +1,126 @@
+/*
+ * Region allocator benchmark
+ *
+ * Drives __alloc()/__free() of one process with many live regions: every
+ * region is allocated, looked up at random, half of them are freed and
+ * allocated again with another size, then all are freed. Memory is only
+ * reserved (lazy allocation), so the cost measured is the one of the
+ * symbol table and of the free regions.
+ *
+ * Usage: rgbench [regions] [region size]
+ */
+
+#include "mm.h"
+#include "common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define RGBENCH_DEFAULT_NRG 100000
+#define RGBENCH_DEFAULT_SIZE 32
+#define RGBENCH_LOOKUPS 1000000
+
+/* Region ids spread over [0, 2^30), distinct for distinct i */
+static int rgbench_id(int i)
+{
+  return (int)(((uint32_t)i * 2654435761u) & 0x3fffffff);
+}
+
+static double elapsed(struct timespec *t0)
+{
+  struct timespec t1;
+
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  return (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+static void report(const char *what, long nop, double secs)
+{
+  printf("%-24s %9ld ops %9.3f ms %8.1f ns/op\n",
+         what, nop, secs * 1e3, nop > 0 ? secs * 1e9 / nop : 0.0);
+}
+
+int main(int argc, char *argv[])
+{
+  struct pcb_t proc;
+  struct memphy_struct mram;
+  struct vm_rg_struct *rg;
+  struct timespec t0;
+  int nrg = RGBENCH_DEFAULT_NRG, size = RGBENCH_DEFAULT_SIZE;
+  int i, addr, nfail = 0;
+  long hits = 0;
+  unsigned int seed = 1;
+
+  if (argc > 1)
+    nrg = atoi(argv[1]);
+  if (argc > 2)
+    size = atoi(argv[2]);
+  if (nrg <= 0 || size <= 0)
+  {
+    printf("Usage: rgbench [regions] [region size]\n");
+    return 1;
+  }
+  if ((long)nrg * size > BIT(PAGING_CPU_BUS_WIDTH))
+  {
+    printf("%d regions of %d bytes do not fit the %lu bytes address space\n",
+           nrg, size, (unsigned long)BIT(PAGING_CPU_BUS_WIDTH));
+    return 1;
+  }
+
+  vm_lazy_alloc = 1;
+  memset(&proc, 0, sizeof(proc));
+  init_memphy(&mram, PAGING_PAGESZ * 16, 1);
+  proc.mram = &mram;
+  proc.mm = malloc(sizeof(struct mm_struct));
+  if (proc.mm == NULL || init_mm(proc.mm, &proc) != 0)
+  {
+    printf("Out of memory\n");
+    return 1;
+  }
+
+  printf("%d regions of %d bytes\n", nrg, size);
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (i = 0; i < nrg; i++)
+    nfail += (__alloc(&proc, 0, rgbench_id(i), size, &addr) != 0);
+  report("alloc", nrg, elapsed(&t0));
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (i = 0; i < RGBENCH_LOOKUPS; i++)
+  {
+    seed = seed * 1103515245u + 12345u;
+    rg = get_symrg_byid(proc.mm, rgbench_id((seed >> 8) % nrg));
+    hits += (rg != NULL && rg->rg_end - rg->rg_start == (unsigned long)size);
+  }
+  report("lookup", RGBENCH_LOOKUPS, elapsed(&t0));
+  if (hits != RGBENCH_LOOKUPS)
+    nfail++;
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (i = 0; i < nrg; i += 2)
+    nfail += (__free(&proc, 0, rgbench_id(i)) != 0);
+  report("free half", (nrg + 1) / 2, elapsed(&t0));
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (i = 0; i < nrg; i += 2)
+    nfail += (__alloc(&proc, 0, rgbench_id(i), size / 2 + 1, &addr) != 0);
+  report("realloc half", (nrg + 1) / 2, elapsed(&t0));
+
+  printf("table %d/%d slots, heap top %lu bytes\n",
+         proc.mm->symrg_cnt, proc.mm->symrg_cap, proc.mm->mmap->sbrk);
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (i = 0; i < nrg; i++)
+    nfail += (__free(&proc, 0, rgbench_id(i)) != 0);
+  report("free all", nrg, elapsed(&t0));
+
+  if (proc.mm->symrg_cnt != 0 || nfail != 0)
+  {
+    printf("%d operations failed, %d regions left\n",
+           nfail, proc.mm->symrg_cnt);
+    return 1;
+  }
+
+  return 0;
+}
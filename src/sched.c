@@ -100,6 +100,27 @@ void add_proc(struct pcb_t * proc) {
     
     add_mlq_proc(proc);
 }
+
+/* Room left in the ready queue of proc, with queue_lock held */
+static int ready_queue_room(struct pcb_t * proc) {
+    return MAX_QUEUE_SIZE - mlq_ready_queue[proc->prio].size;
+}
+
+int add_forked_proc(struct pcb_t * proc) {
+    proc->ready_queue = &ready_queue;
+    proc->mlq_ready_queue = mlq_ready_queue;
+    proc->running_list = &running_list;
+
+    pthread_mutex_lock(&queue_lock);
+    if (ready_queue_room(proc) < 2) {
+        pthread_mutex_unlock(&queue_lock);
+        return -1;
+    }
+    enqueue(&running_list, proc);
+    enqueue(&mlq_ready_queue[proc->prio], proc);
+    pthread_mutex_unlock(&queue_lock);
+    return 0;
+}
 #else
 struct pcb_t * get_proc(void) {
     struct pcb_t * proc = NULL;
@@ -131,4 +152,32 @@ void add_proc(struct pcb_t * proc) {
     enqueue(&ready_queue, proc);
     pthread_mutex_unlock(&queue_lock);
 }
-#endif
\ No newline at end of file
+
+/* Room left in the ready queue of proc, with queue_lock held */
+static int ready_queue_room(struct pcb_t * proc) {
+    return MAX_QUEUE_SIZE - ready_queue.size;
+}
+
+int add_forked_proc(struct pcb_t * proc) {
+    proc->ready_queue = &ready_queue;
+    proc->running_list = &running_list;
+
+    pthread_mutex_lock(&queue_lock);
+    if (ready_queue_room(proc) < 2) {
+        pthread_mutex_unlock(&queue_lock);
+        return -1;
+    }
+    enqueue(&running_list, proc);
+    enqueue(&ready_queue, proc);
+    pthread_mutex_unlock(&queue_lock);
+    return 0;
+}
+#endif
+
+int forked_queue_full(struct pcb_t * proc) {
+    int ret;
+    pthread_mutex_lock(&queue_lock);
+    ret = ready_queue_room(proc) < 2;
+    pthread_mutex_unlock(&queue_lock);
+    return ret;
+}
\ No newline at end of file
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2025 pdnguyen of HCMC University of Technology VNU-HCM
+ */
+
+/* Sierra release
+ * Source Code License Grant: The authors hereby grant to Licensee
+ * personal permission to use and modify the Licensed Source Code
+ * for the sole purpose of studying while attending the course CO2018.
+ */
+
+#include "syscall.h"
+#include "loader.h"
+#include "sched.h"
+#include "mm.h"
+#include <stdlib.h>
+
+/* Give back what a child that will not run took from its parent */
+static void fork_undo(struct pcb_t *child)
+{
+   if (child->mm != NULL)
+   { /* Whatever was shared already goes back */
+      free_pcb_memph(child);
+      free_mm(child->mm);
+      free(child->mm);
+   }
+   unload(child);
+}
+
+/* New process running the code of caller from the next instruction, its
+ * memory shared copy-on-write, its pid back in a3 */
+int __sys_fork(struct pcb_t *caller, struct sc_regs* regs)
+{
+   struct pcb_t *child;
+
+   /* Share nothing with a child the ready queue has no room for, the
+    * caller needs a slot too when it is put back */
+   if (forked_queue_full(caller))
+   {
+      printf("\tFork of process %d failed, ready queue full\n", caller->pid);
+      regs->a3 = -1;
+      return -1;
+   }
+
+   child = clone_pcb(caller);
+   child->mm = malloc(sizeof(struct mm_struct));
+   if (child->mm == NULL || vm_fork_mm(caller, child) != 0)
+   {
+      printf("\tFork of process %d failed\n", caller->pid);
+      fork_undo(child);
+      regs->a3 = -1;
+      return -1;
+   }
+   child->oom_killed = 0;
+   kswapd_register(child);
+
+   /* Another CPU may have filled the queue since */
+   if (add_forked_proc(child) != 0)
+   {
+      printf("\tFork of process %d failed, ready queue full\n", caller->pid);
+      kswapd_unregister(child);
+      fork_undo(child);
+      regs->a3 = -1;
+      return -1;
+   }
+   printf("\tForked process %d from %d, PRIO: %d\n",
+          child->pid, caller->pid, child->prio);
+   regs->a3 = child->pid;
+
+   return 0;
+}
@@ -39,27 +39,16 @@ static void kill_all_in_queue(struct queue_t *q, const char *target_name) {
 int __sys_killall(struct pcb_t *caller, struct sc_regs* regs)
 {
     char proc_name[100];
-    uint32_t data;
-    int i = 0;
+    int i, len;
     uint32_t memrg = regs->a1;  // hardcode for demo only
 
-    /* Get name of the target proc from the given memory region
-     * We assume that libread returns -1 in [data] when end-of-string is reached.
+    /* Get name of the target proc from the given memory region, in one
+     * read. The name ends at a -1 byte, or a 0 one.
      */
-    while (1) {
-        data = 0;
-        libread(caller, memrg, i, &data);
-        if (data == (uint32_t)-1) { 
-            proc_name[i] = '\0';
-            break;
-        }
-        proc_name[i] = (char)data;
-        i++;
-        if (i >= (sizeof(proc_name) - 1)) {
-            proc_name[i] = '\0';
-            break;
-        }
-    }
+    len = libread_range(caller, memrg, 0, (BYTE *)proc_name, sizeof(proc_name) - 1);
+    for (i = 0; i < len && proc_name[i] != '\0' && (BYTE)proc_name[i] != (BYTE)-1; i++)
+        ;
+    proc_name[i] = '\0';
     printf("The procname retrieved from memregionid %d is \"%s\"\n", memrg, proc_name);
 
     /* Traverse process lists to terminate the processes with matching name.
@@ -21,7 +21,13 @@ int __sys_memmap(struct pcb_t *caller, struct sc_regs* regs)
 
    switch (memop) {
    case SYSMEM_MAP_OP:
-            /* Reserved process case*/
+            /* Area of a2 bytes mapping host file a3 ("mmapfile<a3>" in
+             * config, 0 for anonymous memory, a2 = 0 for the whole file),
+             * its vm area id back in a3 */
+            regs->a3 = vm_mmap_area(caller, regs->a2, regs->a3);
+#ifdef IODUMP
+            printf("Mapped area %d of %u bytes\n", (int)regs->a3, regs->a2);
+#endif
             break;
    case SYSMEM_INC_OP:
             inc_vma_limit(caller, regs->a2, regs->a3);
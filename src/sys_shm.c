@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2025 pdnguyen of HCMC University of Technology VNU-HCM
+ */
+
+/* Sierra release
+ * Source Code License Grant: The authors hereby grant to Licensee
+ * personal permission to use and modify the Licensed Source Code
+ * for the sole purpose of studying while attending the course CO2018.
+ */
+
+#include "syscall.h"
+#include "mm.h"
+
+/* Segment of key a1, created with a2 bytes if new, its id back in a3 */
+int __sys_shmget(struct pcb_t *caller, struct sc_regs* regs)
+{
+   regs->a3 = shm_get(regs->a1, regs->a2);
+#ifdef IODUMP
+   printf("Shared segment %d for key %u\n", (int)regs->a3, regs->a1);
+#endif
+
+   return 0;
+}
+
+/* Attach the segment of key a1, its vm area id back in a3 */
+int __sys_shmat(struct pcb_t *caller, struct sc_regs* regs)
+{
+   regs->a3 = shm_attach(caller, regs->a1);
+#ifdef IODUMP
+   printf("Attached key %u as area %d\n", regs->a1, (int)regs->a3);
+#endif
+
+   return 0;
+}
+
+/* Detach the shared area a1 */
+int __sys_shmdt(struct pcb_t *caller, struct sc_regs* regs)
+{
+   int ret = shm_detach(caller, regs->a1);
+
+#ifdef IODUMP
+   printf("Detached area %u%s\n", regs->a1, ret != 0 ? " failed" : "");
+#endif
+
+   return ret;
+}